@@ -0,0 +1,451 @@
+#include "ContractionHierarchy.h"
+#include "RouteEngine.h"
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+// most nodes a witness search settles before giving up, when contracting a node and when
+// only estimating how many shortcuts contracting it would add; a search that gives up too
+// early only costs a shortcut that was not strictly needed
+const int WITNESS_SETTLE_LIMIT = 500;
+const int ESTIMATE_SETTLE_LIMIT = 50;
+
+// Does the work of ContractionHierarchy::build: keeps the graph of the nodes not yet
+// contracted as adjacency lists of arcs, and every arc ever made (segments and shortcuts)
+// as a record so shortcuts can say which two arcs they replace.
+class HierarchyBuilder
+{
+public:
+    HierarchyBuilder(const StreetGraph& graph);
+    void contractAll();
+
+    // one arc of the remaining graph; the same arc is listed at both of its ends
+    struct Arc {
+        int m_to;
+        double m_weight;
+        int m_record;
+    };
+
+    // a segment (with the graph edge leaving m_from) or a shortcut (with its middle node and
+    // the records from m_from to the middle and from the middle to m_to)
+    struct Record {
+        int m_from;
+        int m_to;
+        double m_weight;
+        int m_edge;
+        int m_middle;
+        int m_first;
+        int m_second;
+    };
+
+    vector<Record> m_records;
+    vector<vector<int>> m_upRecords;    // the records each node still had when it was contracted
+    vector<int> m_ranks;
+
+private:
+    const StreetGraph& m_graph;
+    vector<vector<Arc>> m_adjacency;    // arcs between nodes that have not been contracted
+    vector<int> m_contractedNeighbors;
+
+    // witness search state, stamped like the router's
+    vector<unsigned int> m_stamp;
+    vector<double> m_distance;
+    unsigned int m_generation;
+    IndexedMinHeap m_heap;
+
+    // Helper Functions
+    int priority(int node);
+    int contract(int node, bool estimateOnly);
+    void witnessSearch(int source, int excluded, double limit, int settleLimit);
+    double witnessDistance(int node) const;
+    void addShortcut(int from, int to, double weight, int middle, int first, int second);
+    void addRecord(int from, int to, double weight, int edge, int middle, int first, int second);
+};
+
+HierarchyBuilder::HierarchyBuilder(const StreetGraph& graph)
+:   m_graph(graph), m_generation(0)
+{
+    int nNodes = graph.getNodeCount();
+    m_upRecords.resize(nNodes);
+    m_ranks.assign(nNodes, -1);
+    m_adjacency.resize(nNodes);
+    m_contractedNeighbors.assign(nNodes, 0);
+    m_stamp.assign(nNodes, 0);
+    m_distance.resize(nNodes);
+
+    // one arc per pair of neighboring nodes, keeping the shortest segment between them;
+    // every segment is seen from both ends, so only look at it from its lower numbered end
+    for (int u = 0; u < nNodes; u++) {
+        for (int e : graph.getEdges(u)) {
+            int v = graph.getEdgeTarget(e);
+            if (v <= u)
+                continue;
+            double weight = graph.getEdgeLength(e);
+            bool found = false;
+            for (Arc& a : m_adjacency[u]) {
+                if (a.m_to == v) {
+                    found = true;
+                    if (weight < a.m_weight) {
+                        a.m_weight = weight;
+                        m_records[a.m_record].m_weight = weight;
+                        m_records[a.m_record].m_edge = e;
+                        for (Arc& b : m_adjacency[v]) {
+                            if (b.m_to == u)
+                                b.m_weight = weight;
+                        }
+                    }
+                    break;
+                }
+            }
+            if (!found)
+                addRecord(u, v, weight, e, -1, -1, -1);
+        }
+    }
+}
+
+void HierarchyBuilder::contractAll()
+{
+    // order the nodes by how little contracting them would add to the graph
+    IndexedMinHeap queue;
+    for (int n = 0; n < m_adjacency.size(); n++)
+        queue.push(n, priority(n));
+
+    int nextRank = 0;
+    while (!queue.empty()) {
+        // priorities go stale as neighbors are contracted, and are only brought up to date
+        // when a node comes off the queue; if this node's has risen past the next one's,
+        // put it back and look again
+        int node = queue.popMin();
+        int current = priority(node);
+        if (!queue.empty() && current > queue.topKey()) {
+            queue.push(node, current);
+            continue;
+        }
+
+        // add the shortcuts, then its remaining arcs become its up-edges
+        contract(node, false);
+        m_ranks[node] = nextRank++;
+        vector<Arc> arcs;
+        arcs.swap(m_adjacency[node]);
+        for (const Arc& a : arcs) {
+            m_upRecords[node].push_back(a.m_record);
+            vector<Arc>& back = m_adjacency[a.m_to];
+            for (int i = 0; i < back.size(); i++) {
+                if (back[i].m_to == node) {
+                    back[i] = back.back();
+                    back.pop_back();
+                    break;
+                }
+            }
+            m_contractedNeighbors[a.m_to]++;
+        }
+    }
+}
+
+int HierarchyBuilder::priority(int node)
+{
+    // the change in the number of arcs contracting the node would cause, plus how many
+    // of its neighbors are already gone so contraction spreads evenly over the map
+    int nShortcuts = contract(node, true);
+    return 2 * (nShortcuts - (int)m_adjacency[node].size()) + m_contractedNeighbors[node];
+}
+
+int HierarchyBuilder::contract(int node, bool estimateOnly)
+{
+    // for every pair of neighbors, a shortcut is needed unless a witness route that avoids
+    // the node is at most as long as the route through it
+    const vector<Arc>& arcs = m_adjacency[node];
+    int nShortcuts = 0;
+    for (int i = 0; i + 1 < arcs.size(); i++) {
+        double limit = 0;
+        for (int j = i + 1; j < arcs.size(); j++)
+            limit = max(limit, arcs[i].m_weight + arcs[j].m_weight);
+        witnessSearch(arcs[i].m_to, node, limit, estimateOnly ? ESTIMATE_SETTLE_LIMIT : WITNESS_SETTLE_LIMIT);
+
+        for (int j = i + 1; j < arcs.size(); j++) {
+            double through = arcs[i].m_weight + arcs[j].m_weight;
+            if (witnessDistance(arcs[j].m_to) <= through)
+                continue;
+            nShortcuts++;
+            if (!estimateOnly)
+                addShortcut(arcs[i].m_to, arcs[j].m_to, through, node, arcs[i].m_record, arcs[j].m_record);
+        }
+    }
+    return nShortcuts;
+}
+
+void HierarchyBuilder::witnessSearch(int source, int excluded, double limit, int settleLimit)
+{
+    // Dijkstra from source over the remaining graph without the excluded node, stopping at
+    // the limit or after settling enough nodes
+    m_generation++;
+    if (m_generation == 0) {
+        fill(m_stamp.begin(), m_stamp.end(), 0);
+        m_generation = 1;
+    }
+    m_heap.clear();
+    m_stamp[source] = m_generation;
+    m_distance[source] = 0;
+    m_heap.push(source, 0);
+
+    int nSettled = 0;
+    while (!m_heap.empty()) {
+        int current = m_heap.popMin();
+        if (m_distance[current] > limit || ++nSettled > settleLimit)
+            break;
+        for (const Arc& a : m_adjacency[current]) {
+            if (a.m_to == excluded)
+                continue;
+            double newDistance = m_distance[current] + a.m_weight;
+            if (m_stamp[a.m_to] == m_generation && newDistance >= m_distance[a.m_to])
+                continue;
+            m_stamp[a.m_to] = m_generation;
+            m_distance[a.m_to] = newDistance;
+            if (m_heap.contains(a.m_to))
+                m_heap.decreaseKey(a.m_to, newDistance);
+            else
+                m_heap.push(a.m_to, newDistance);
+        }
+    }
+}
+
+double HierarchyBuilder::witnessDistance(int node) const
+{
+    // any distance reached stands for a real route, settled or not
+    if (m_stamp[node] != m_generation)
+        return numeric_limits<double>::infinity();
+    return m_distance[node];
+}
+
+void HierarchyBuilder::addShortcut(int from, int to, double weight, int middle, int first, int second)
+{
+    // replace a longer arc between the two nodes if there is one; a shorter one would have
+    // been found as a witness
+    for (Arc& a : m_adjacency[from]) {
+        if (a.m_to != to)
+            continue;
+        if (a.m_weight <= weight)
+            return;
+        int record = m_records.size();
+        Record r = { from, to, weight, -1, middle, first, second };
+        m_records.push_back(r);
+        a.m_weight = weight;
+        a.m_record = record;
+        for (Arc& b : m_adjacency[to]) {
+            if (b.m_to == from) {
+                b.m_weight = weight;
+                b.m_record = record;
+            }
+        }
+        return;
+    }
+    addRecord(from, to, weight, -1, middle, first, second);
+}
+
+void HierarchyBuilder::addRecord(int from, int to, double weight, int edge, int middle, int first, int second)
+{
+    int record = m_records.size();
+    Record r = { from, to, weight, edge, middle, first, second };
+    m_records.push_back(r);
+    Arc forward = { to, weight, record };
+    Arc backward = { from, weight, record };
+    m_adjacency[from].push_back(forward);
+    m_adjacency[to].push_back(backward);
+}
+
+//******************** ContractionHierarchy functions *************************
+
+ContractionHierarchy::ContractionHierarchy()
+:   m_nShortcuts(0)
+{
+    clear();
+}
+
+void ContractionHierarchy::clear()
+{
+    m_ranks.clear();
+    m_upOffsets.clear();
+    m_upTargets.clear();
+    m_upWeights.clear();
+    m_upEdges.clear();
+    m_upMiddles.clear();
+    m_upLowerChildren.clear();
+    m_upHigherChildren.clear();
+    m_nShortcuts = 0;
+}
+
+void ContractionHierarchy::build(const StreetGraph& graph)
+{
+    clear();
+    HierarchyBuilder builder(graph);
+    builder.contractAll();
+
+    // number the up-edges node by node
+    int nNodes = graph.getNodeCount();
+    vector<int> offsets(nNodes + 1, 0);
+    for (int n = 0; n < nNodes; n++)
+        offsets[n + 1] = offsets[n] + builder.m_upRecords[n].size();
+    vector<int> upOfRecord(builder.m_records.size(), -1);
+    for (int n = 0; n < nNodes; n++) {
+        for (int k = 0; k < builder.m_upRecords[n].size(); k++)
+            upOfRecord[builder.m_upRecords[n][k]] = offsets[n] + k;
+    }
+
+    // lay each up-edge out from its less important end
+    int nUp = offsets[nNodes];
+    vector<int> targets(nUp);
+    vector<double> weights(nUp);
+    vector<int> edges(nUp, -1);
+    vector<int> middles(nUp, -1);
+    vector<int> lowerChildren(nUp, -1);
+    vector<int> higherChildren(nUp, -1);
+    for (int n = 0; n < nNodes; n++) {
+        for (int record : builder.m_upRecords[n]) {
+            const HierarchyBuilder::Record& r = builder.m_records[record];
+            int up = upOfRecord[record];
+            bool fromHere = r.m_from == n;
+            targets[up] = fromHere ? r.m_to : r.m_from;
+            weights[up] = r.m_weight;
+            if (r.m_middle == -1)
+                edges[up] = fromHere ? r.m_edge : graph.getReverseEdge(r.m_from, r.m_edge);
+            else {
+                m_nShortcuts++;
+                middles[up] = r.m_middle;
+                lowerChildren[up] = upOfRecord[fromHere ? r.m_first : r.m_second];
+                higherChildren[up] = upOfRecord[fromHere ? r.m_second : r.m_first];
+            }
+        }
+    }
+
+    m_ranks.adopt(builder.m_ranks);
+    m_upOffsets.adopt(offsets);
+    m_upTargets.adopt(targets);
+    m_upWeights.adopt(weights);
+    m_upEdges.adopt(edges);
+    m_upMiddles.adopt(middles);
+    m_upLowerChildren.adopt(lowerChildren);
+    m_upHigherChildren.adopt(higherChildren);
+}
+
+bool ContractionHierarchy::isBuilt() const
+{
+    return !m_upOffsets.empty();
+}
+
+void ContractionHierarchy::addSnapshotSections(SnapshotWriter& writer) const
+{
+    writer.addSection(SECTION_CH_RANKS, m_ranks.data(), m_ranks.size() * sizeof(int));
+    writer.addSection(SECTION_CH_UP_OFFSETS, m_upOffsets.data(), m_upOffsets.size() * sizeof(int));
+    writer.addSection(SECTION_CH_UP_TARGETS, m_upTargets.data(), m_upTargets.size() * sizeof(int));
+    writer.addSection(SECTION_CH_UP_WEIGHTS, m_upWeights.data(), m_upWeights.size() * sizeof(double));
+    writer.addSection(SECTION_CH_UP_EDGES, m_upEdges.data(), m_upEdges.size() * sizeof(int));
+    writer.addSection(SECTION_CH_UP_MIDDLES, m_upMiddles.data(), m_upMiddles.size() * sizeof(int));
+    writer.addSection(SECTION_CH_UP_LOWER_CHILDREN, m_upLowerChildren.data(), m_upLowerChildren.size() * sizeof(int));
+    writer.addSection(SECTION_CH_UP_HIGHER_CHILDREN, m_upHigherChildren.data(), m_upHigherChildren.size() * sizeof(int));
+}
+
+bool ContractionHierarchy::attach(const MappedSnapshot& snapshot, const StreetGraph& graph)
+{
+    // a snapshot saved without a hierarchy simply has none of these sections
+    clear();
+    int nNodes = graph.getNodeCount();
+    bool ok = snapshot.attach(SECTION_CH_RANKS, m_ranks, nNodes)
+           && snapshot.attach(SECTION_CH_UP_OFFSETS, m_upOffsets, nNodes + 1)
+           && snapshot.attach(SECTION_CH_UP_TARGETS, m_upTargets);
+    int nUp = m_upTargets.size();
+    ok = ok && m_upOffsets[nNodes] == nUp
+            && snapshot.attach(SECTION_CH_UP_WEIGHTS, m_upWeights, nUp)
+            && snapshot.attach(SECTION_CH_UP_EDGES, m_upEdges, nUp)
+            && snapshot.attach(SECTION_CH_UP_MIDDLES, m_upMiddles, nUp)
+            && snapshot.attach(SECTION_CH_UP_LOWER_CHILDREN, m_upLowerChildren, nUp)
+            && snapshot.attach(SECTION_CH_UP_HIGHER_CHILDREN, m_upHigherChildren, nUp);
+
+    // the searches and unpack index with these ids without checking them, so a damaged
+    // file must be turned away here
+    ok = ok && isConsistent(graph);
+    if (!ok) {
+        clear();
+        return false;
+    }
+    for (int up = 0; up < nUp; up++) {
+        if (m_upMiddles[up] != -1)
+            m_nShortcuts++;
+    }
+    return true;
+}
+
+// check, once over every up-edge, that the offsets only ever grow, that every id is in
+// range, that every weight is a length the heaps can order, and that unpacking ends: each
+// up-edge climbs to a more important node, and a shortcut's children are up-edges of its
+// middle node, which is less important than either end, so every step of unpack goes down
+// in rank
+bool ContractionHierarchy::isConsistent(const StreetGraph& graph) const
+{
+    int nNodes = graph.getNodeCount();
+    if (m_upOffsets[0] != 0)
+        return false;
+    for (int n = 0; n < nNodes; n++) {
+        if (m_upOffsets[n + 1] < m_upOffsets[n])
+            return false;
+    }
+    for (int n = 0; n < nNodes; n++) {
+        for (int up = m_upOffsets[n]; up < m_upOffsets[n + 1]; up++) {
+            int target = m_upTargets[up];
+            if (target < 0 || target >= nNodes || m_ranks[target] <= m_ranks[n])
+                return false;
+            if (!(m_upWeights[up] >= 0 && m_upWeights[up] < numeric_limits<double>::infinity()))
+                return false;
+            int middle = m_upMiddles[up];
+            if (middle == -1) {
+                // an original segment's edge leaves this node for the target
+                int edge = m_upEdges[up];
+                if (edge < graph.firstEdge(n) || edge >= graph.endEdge(n) || graph.getEdgeTarget(edge) != target)
+                    return false;
+                continue;
+            }
+            if (middle < 0 || middle >= nNodes || m_ranks[middle] >= m_ranks[n])
+                return false;
+            int lower = m_upLowerChildren[up];
+            int higher = m_upHigherChildren[up];
+            if (lower < m_upOffsets[middle] || lower >= m_upOffsets[middle + 1]
+                    || higher < m_upOffsets[middle] || higher >= m_upOffsets[middle + 1])
+                return false;
+        }
+    }
+    return true;
+}
+
+int ContractionHierarchy::getUpEdgeCount() const
+{
+    return m_upTargets.size();
+}
+
+int ContractionHierarchy::getShortcutCount() const
+{
+    return m_nShortcuts;
+}
+
+void ContractionHierarchy::unpack(const StreetGraph& graph, int up, int from, int to, vector<int>& edges) const
+{
+    // an original segment: its edge leaves the less important end, so going the other way
+    // takes the segment's other direction
+    bool upward = m_ranks[from] < m_ranks[to];
+    int middle = m_upMiddles[up];
+    if (middle == -1) {
+        edges.push_back(upward ? m_upEdges[up] : graph.getReverseEdge(to, m_upEdges[up]));
+        return;
+    }
+
+    // a shortcut: the route between its ends goes through the middle node, along the middle
+    // node's up-edges to each end
+    if (upward) {
+        unpack(graph, m_upLowerChildren[up], from, middle, edges);
+        unpack(graph, m_upHigherChildren[up], middle, to, edges);
+    }
+    else {
+        unpack(graph, m_upHigherChildren[up], from, middle, edges);
+        unpack(graph, m_upLowerChildren[up], middle, to, edges);
+    }
+}
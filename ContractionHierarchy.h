@@ -0,0 +1,93 @@
+// ContractionHierarchy.h
+
+#ifndef CONTRACTIONHIERARCHY_INCLUDED
+#define CONTRACTIONHIERARCHY_INCLUDED
+
+#include <vector>
+#include "StreetGraph.h"
+#include "Snapshot.h"
+
+using namespace std;
+
+// Contraction hierarchy over a StreetGraph, for answering many route queries on one map.
+//
+// Building it ranks every node by importance and removes ("contracts") the nodes from least
+// to most important. Whenever removing a node would lengthen the shortest route between two
+// of its remaining neighbors, a shortcut between those neighbors is added, with the removed
+// node remembered as its middle. What is kept is, for every node, the up-edges: the original
+// segments and shortcuts that lead to more important nodes.
+//
+// A shortest route always climbs from the start to some node and then descends to the end,
+// so a query only runs a small search upward from each end (RouteEngine's
+// SEARCH_CONTRACTION_HIERARCHY mode). Shortcuts on the route found are unpacked back into
+// the graph's edges through their middle nodes. Because every segment of the graph can be
+// travelled both ways, the same up-edges serve both searches.
+class ContractionHierarchy
+{
+public:
+    ContractionHierarchy();
+    void clear();
+    void build(const StreetGraph& graph);
+    bool isBuilt() const;
+
+    // snapshots
+    void addSnapshotSections(SnapshotWriter& writer) const;
+    bool attach(const MappedSnapshot& snapshot, const StreetGraph& graph);
+
+    // nodes and their up-edges
+    int getRank(int node) const;
+    EdgeRange getUpEdges(int node) const;
+    int getUpTarget(int up) const;
+    double getUpWeight(int up) const;
+    int getUpEdgeCount() const;
+    int getShortcutCount() const;
+
+    // append to edges the graph edges that up-edge "up" stands for, travelled from node
+    // "from" to node "to" (its two ends, in either order)
+    void unpack(const StreetGraph& graph, int up, int from, int to, vector<int>& edges) const;
+
+    ContractionHierarchy(const ContractionHierarchy&) = delete;
+    ContractionHierarchy& operator=(const ContractionHierarchy&) = delete;
+
+private:
+    // rank of every node (0 was contracted first), and the up-edges of each node in
+    // compressed sparse row form
+    MappedArray<int> m_ranks;
+    MappedArray<int> m_upOffsets;
+    MappedArray<int> m_upTargets;
+    MappedArray<double> m_upWeights;
+
+    // how to unpack an up-edge: an original segment keeps the graph edge that leaves its
+    // less important end (and -1 as its middle); a shortcut keeps its middle node and the
+    // up-edges of the middle node that lead to its less and more important ends
+    MappedArray<int> m_upEdges;
+    MappedArray<int> m_upMiddles;
+    MappedArray<int> m_upLowerChildren;
+    MappedArray<int> m_upHigherChildren;
+    int m_nShortcuts;
+
+    // Helper Function
+    bool isConsistent(const StreetGraph& graph) const;
+};
+
+inline int ContractionHierarchy::getRank(int node) const
+{
+    return m_ranks[node];
+}
+
+inline EdgeRange ContractionHierarchy::getUpEdges(int node) const
+{
+    return EdgeRange(m_upOffsets[node], m_upOffsets[node + 1]);
+}
+
+inline int ContractionHierarchy::getUpTarget(int up) const
+{
+    return m_upTargets[up];
+}
+
+inline double ContractionHierarchy::getUpWeight(int up) const
+{
+    return m_upWeights[up];
+}
+
+#endif
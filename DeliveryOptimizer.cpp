@@ -1,10 +1,832 @@
 #include "provided.h"
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include "PointGrid.h"
+#include "GeoDistance.h"
+#include "ThreadPool.h"
 
 
 using namespace std;
 
+// without a contraction hierarchy, each stop costs one search of the map, so past this
+// many stops the order is worked out on crow distance instead; with one, the searches are
+// cheap but the matrix still grows with the square of the stops (2000 stops take 32 MB)
+const int ROAD_DISTANCE_STOP_LIMIT = 100;
+const int HIERARCHY_ROAD_DISTANCE_STOP_LIMIT = 2000;
 
+const int NEIGHBOR_COUNT = 8;               // closest locations tried as new neighbors of each
+const int MAX_SEGMENT_LENGTH = 3;           // longest run of stops Or-opt moves at once
+const double MIN_GAIN = 1e-9;               // smallest shortening counted as an improvement
+
+// the time by which a local search given timeBudget seconds must stop; with no budget (an
+// infinite one, the default) it runs until no move helps
+static chrono::steady_clock::time_point deadlineAfter(double timeBudget)
+{
+    if (timeBudget == numeric_limits<double>::infinity())
+        return chrono::steady_clock::time_point::max();
+    return chrono::steady_clock::now()
+        + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(timeBudget));
+}
+
+// fill grid with the given locations
+static void buildPointGrid(const vector<GeoCoord>& locations, PointGrid& grid)
+{
+    vector<double> latitudes;
+    vector<double> longitudes;
+    for (int i = 0; i < locations.size(); i++) {
+        latitudes.push_back(locations[i].latitude);
+        longitudes.push_back(locations[i].longitude);
+    }
+    grid.build(latitudes, longitudes);
+}
+
+// fill neighbors with the (up to) k closest other locations to each location, closest first,
+// and neighborDistances with the distances to them; road distances (row by row, one row per
+// location) if given, otherwise crow distances, which are found with a grid and worked out
+// with coords
+static void findClosest(const vector<GeoCoord>& locations, const vector<double>* roadDistances,
+                        const CoordTable& coords, int k, vector<vector<int>>& neighbors,
+                        vector<vector<double>>& neighborDistances)
+{
+    int nLocations = locations.size();
+    int nNeighbors = min(k, nLocations - 1);
+    neighbors.assign(nLocations, vector<int>());
+    neighborDistances.assign(nLocations, vector<double>(nNeighbors));
+    if (roadDistances == nullptr) {
+        PointGrid grid;
+        buildPointGrid(locations, grid);
+        for (int a = 0; a < nLocations; a++) {
+            grid.findNearest(locations[a].latitude, locations[a].longitude, nNeighbors, neighbors[a], a);
+            coords.milesFrom(a, neighbors[a].data(), nNeighbors, neighborDistances[a].data());
+        }
+        return;
+    }
+    
+    vector<pair<double, int>> candidates;
+    for (int a = 0; a < nLocations; a++) {
+        candidates.clear();
+        for (int b = 0; b < nLocations; b++) {
+            if (b != a)
+                candidates.push_back(make_pair((*roadDistances)[(long long)a * nLocations + b], b));
+        }
+        partial_sort(candidates.begin(), candidates.begin() + nNeighbors, candidates.end());
+        for (int i = 0; i < nNeighbors; i++) {
+            neighbors[a].push_back(candidates[i].second);
+            neighborDistances[a][i] = candidates[i].first;
+        }
+    }
+}
+
+// Builds a short closed tour through a set of locations, location 0 being the depot.
+//
+// A nearest neighbor tour is built first and then improved by local search until no move
+// helps or the time budget runs out. The moves are 2-opt (replace two edges of the tour by
+// two others, reversing the part in between) and Or-opt (move a run of up to
+// MAX_SEGMENT_LENGTH stops elsewhere, either way round). Only moves that make a location
+// the tour neighbor of one of its NEIGHBOR_COUNT closest locations are tried. A location
+// whose moves have all been tried without success is left alone ("don't look") until a
+// move changes one of its tour edges. Both moves assume the distance between two locations
+// is the same either way, which holds for crow distance and for road distance on maps
+// where every segment can be travelled both ways.
+//
+// With crow distance, a PointGrid over the locations finds the closest location left while
+// building and the closest locations of each for the local search, so neither has to
+// compare every pair of locations, and a CoordTable does the trigonometry of each location
+// once rather than for every distance asked for.
+class TourBuilder
+{
+public:
+    TourBuilder(const vector<GeoCoord>& locations, const vector<double>* roadDistances);
+    void buildNearestNeighbor();
+    void setTour(const vector<int>& tour);      // start from this order instead
+    void improve(double timeBudget);
+    
+    // improve until no move helps or deadline passes; returns whether the tour got shorter
+    bool improveUntil(chrono::steady_clock::time_point deadline);
+    
+    // locations in tour order, starting at the depot
+    void getTour(vector<int>& tour) const;
+    
+private:
+    const vector<GeoCoord>& m_locations;
+    const vector<double>* m_roadDistances;  // row by row, or nullptr to use crow distance
+    PointGrid m_grid;                                // built only for crow distance
+    CoordTable m_coords;                             // likewise
+    int m_nLocations;
+    vector<vector<int>> m_neighbors;    // closest locations to each, closest first
+    vector<vector<double>> m_neighborDistances;     // and the distances to them
+    vector<int> m_tour;                 // location at each position of the closed tour
+    vector<int> m_positions;            // position of each location in m_tour
+    vector<bool> m_queued;              // location is waiting in m_queue to be looked at
+    vector<int> m_queue;
+    int m_queueHead;
+    
+    // Helper Functions
+    double distance(int a, int b) const;
+    int successor(int location) const;
+    int predecessor(int location) const;
+    void findNeighbors();
+    void wake(int location);
+    bool improveTwoOpt(int a);
+    bool improveOrOpt(int a);
+    void reverse(int from, int to);
+    void moveSegment(int first, int length, int after, bool reversed);
+    void place(int position, int location);
+};
+
+TourBuilder::TourBuilder(const vector<GeoCoord>& locations, const vector<double>* roadDistances)
+:   m_locations(locations), m_roadDistances(roadDistances), m_nLocations(locations.size()), m_queueHead(0)
+{
+    if (m_roadDistances == nullptr) {
+        vector<double> latitudes;
+        vector<double> longitudes;
+        for (int i = 0; i < m_nLocations; i++) {
+            latitudes.push_back(m_locations[i].latitude);
+            longitudes.push_back(m_locations[i].longitude);
+        }
+        m_coords.build(latitudes, longitudes);
+    }
+}
+
+void TourBuilder::buildNearestNeighbor()
+{
+    // order the delivery locations based on proximity to one another, keep adding the location that is closest to the current one
+    // finally, return to the depot from the final location
+    m_positions.resize(m_nLocations);
+    if (m_roadDistances == nullptr) {
+        // the grid gives the closest location left directly, taking each out once visited
+        buildPointGrid(m_locations, m_grid);
+        m_tour.assign(1, 0);
+        m_grid.remove(0);
+        int current = 0;
+        for (int i = 1; i < m_nLocations; i++) {
+            current = m_grid.findNearest(m_locations[current].latitude, m_locations[current].longitude);
+            m_tour.push_back(current);
+            m_grid.remove(current);
+        }
+        for (int i = 0; i < m_nLocations; i++)
+            m_positions[m_tour[i]] = i;
+        return;
+    }
+    
+    vector<int> remaining;
+    for (int i = 1; i < m_nLocations; i++)
+        remaining.push_back(i);
+    m_tour.assign(1, 0);
+    int current = 0;
+    while (!remaining.empty()) {
+        double shortestDistance = distance(current, remaining[0]);
+        int shortestDistancePosition = 0;
+        for (int i = 1; i < remaining.size(); i++) {
+            double currentDistance = distance(current, remaining[i]);
+            if (currentDistance < shortestDistance) {
+                shortestDistance = currentDistance;
+                shortestDistancePosition = i;
+            }
+        }
+        current = remaining[shortestDistancePosition];
+        m_tour.push_back(current);
+        
+        // fill the hole with the last remaining location rather than shifting the rest down
+        remaining[shortestDistancePosition] = remaining.back();
+        remaining.pop_back();
+    }
+    
+    for (int i = 0; i < m_nLocations; i++)
+        m_positions[m_tour[i]] = i;
+}
+
+void TourBuilder::setTour(const vector<int>& tour)
+{
+    m_tour = tour;
+    m_positions.resize(m_nLocations);
+    for (int i = 0; i < m_nLocations; i++)
+        m_positions[m_tour[i]] = i;
+}
+
+void TourBuilder::improve(double timeBudget)
+{
+    improveUntil(deadlineAfter(timeBudget));
+}
+
+bool TourBuilder::improveUntil(chrono::steady_clock::time_point deadline)
+{
+    // a tour of three or fewer locations has only one order
+    if (m_nLocations <= 3)
+        return false;
+    findNeighbors();
+    
+    // look at every location once, and again each time one of its tour edges changes
+    m_queue.clear();
+    m_queueHead = 0;
+    m_queued.assign(m_nLocations, false);
+    for (int i = 0; i < m_nLocations; i++)
+        wake(m_tour[i]);
+    
+    bool improved = false;
+    int nLooked = 0;
+    while (m_queueHead < m_queue.size()) {
+        // reading the clock costs more than a look at one location, so only do it now and then
+        if (++nLooked % 64 == 0 && chrono::steady_clock::now() > deadline)
+            break;
+        int a = m_queue[m_queueHead++];
+        m_queued[a] = false;
+        if (improveTwoOpt(a) || improveOrOpt(a)) {
+            wake(a);
+            improved = true;
+        }
+        
+        // reuse the front of the queue once it has all been looked at
+        if (m_queueHead > m_nLocations && m_queueHead * 2 > m_queue.size()) {
+            m_queue.erase(m_queue.begin(), m_queue.begin() + m_queueHead);
+            m_queueHead = 0;
+        }
+    }
+    return improved;
+}
+
+void TourBuilder::getTour(vector<int>& tour) const
+{
+    // the tour is a cycle, so start it again at the depot
+    int start = m_positions[0];
+    tour.clear();
+    for (int i = 0; i < m_nLocations; i++)
+        tour.push_back(m_tour[(start + i) % m_nLocations]);
+}
+
+double TourBuilder::distance(int a, int b) const
+{
+    if (m_roadDistances != nullptr)
+        return (*m_roadDistances)[(long long)a * m_nLocations + b];
+    return m_coords.miles(a, b);
+}
+
+int TourBuilder::successor(int location) const
+{
+    int position = m_positions[location] + 1;
+    return m_tour[position == m_nLocations ? 0 : position];
+}
+
+int TourBuilder::predecessor(int location) const
+{
+    int position = m_positions[location];
+    return m_tour[position == 0 ? m_nLocations - 1 : position - 1];
+}
+
+void TourBuilder::findNeighbors()
+{
+    findClosest(m_locations, m_roadDistances, m_coords, NEIGHBOR_COUNT, m_neighbors, m_neighborDistances);
+}
+
+void TourBuilder::wake(int location)
+{
+    if (!m_queued[location]) {
+        m_queued[location] = true;
+        m_queue.push_back(location);
+    }
+}
+
+bool TourBuilder::improveTwoOpt(int a)
+{
+    // try making each close location c the new neighbor of a, on either side
+    for (int side = 0; side < 2; side++) {
+        int b = side == 0 ? successor(a) : predecessor(a);
+        double ab = distance(a, b);
+        for (int k = 0; k < m_neighbors[a].size(); k++) {
+            // c is no closer than a's current neighbor, and neither are the ones after it
+            int c = m_neighbors[a][k];
+            double ac = m_neighborDistances[a][k];
+            if (ac >= ab)
+                break;
+            int d = side == 0 ? successor(c) : predecessor(c);
+            if (c == b || d == a)
+                continue;
+            
+            // swap edges a-b and c-d for a-c and b-d
+            double gain = ab + distance(c, d) - ac - distance(b, d);
+            if (gain <= MIN_GAIN)
+                continue;
+            if (side == 0)
+                reverse(m_positions[b], m_positions[c]);    // a b .. c d  becomes  a c .. b d
+            else
+                reverse(m_positions[c], m_positions[b]);    // d c .. b a  becomes  d b .. c a
+            wake(b);
+            wake(c);
+            wake(d);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TourBuilder::improveOrOpt(int a)
+{
+    // try moving the run of stops that starts at a next to a location close to either of its ends
+    for (int length = 1; length <= MAX_SEGMENT_LENGTH && length + 2 < m_nLocations; length++) {
+        int first = a;
+        int last = a;
+        for (int i = 1; i < length; i++)
+            last = successor(last);
+        int before = predecessor(first);
+        int after = successor(last);
+        double removeGain = distance(before, first) + distance(last, after) - distance(before, after);
+        if (removeGain <= MIN_GAIN)
+            continue;
+        
+        for (int end = 0; end < 2; end++) {
+            int near = end == 0 ? first : last;
+            for (int c : m_neighbors[near]) {
+                // c must be outside the run
+                int offset = m_positions[c] - m_positions[first];
+                if (offset < 0)
+                    offset += m_nLocations;
+                if (offset < length)
+                    continue;
+                
+                // the run can go on either side of c, the tour being joined up where it was
+                for (int side = 0; side < 2; side++) {
+                    int x = side == 0 ? c : predecessor(c);
+                    int y = side == 0 ? successor(c) : c;
+                    if (x == last)
+                        x = before;
+                    if (y == first)
+                        y = after;
+                    if (x == before && y == after)
+                        continue;
+                    
+                    // x first .. last y, or x last .. first y
+                    double xy = distance(x, y);
+                    double forwardCost = distance(x, first) + distance(last, y) - xy;
+                    double reversedCost = distance(x, last) + distance(first, y) - xy;
+                    bool reversed = reversedCost < forwardCost;
+                    if (removeGain - (reversed ? reversedCost : forwardCost) <= MIN_GAIN)
+                        continue;
+                    moveSegment(first, length, x, reversed);
+                    wake(before);
+                    wake(after);
+                    wake(last);
+                    wake(x);
+                    wake(y);
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// reverse the part of the tour from position from to position to, going forward (and
+// wrapping round the end if need be)
+void TourBuilder::reverse(int from, int to)
+{
+    int length = to - from;
+    if (length < 0)
+        length += m_nLocations;
+    length++;
+    
+    // reversing the rest of the tour instead gives the same cycle, so do the shorter part
+    if (length * 2 > m_nLocations) {
+        int newFrom = to + 1 == m_nLocations ? 0 : to + 1;
+        to = from == 0 ? m_nLocations - 1 : from - 1;
+        from = newFrom;
+        length = m_nLocations - length;
+    }
+    for (int i = 0; i < length / 2; i++) {
+        int p = from + i;
+        if (p >= m_nLocations)
+            p -= m_nLocations;
+        int q = to - i;
+        if (q < 0)
+            q += m_nLocations;
+        swap(m_tour[p], m_tour[q]);
+        m_positions[m_tour[p]] = p;
+        m_positions[m_tour[q]] = q;
+    }
+}
+
+// take the run of length stops starting at location first out of the tour and put it back
+// straight after location after, back to front if reversed
+void TourBuilder::moveSegment(int first, int length, int after, bool reversed)
+{
+    int segment[MAX_SEGMENT_LENGTH];
+    int start = m_positions[first];
+    for (int i = 0; i < length; i++)
+        segment[i] = m_tour[(start + i) % m_nLocations];
+    if (reversed)
+        std::reverse(segment, segment + length);
+    
+    // the stops between the run and "after" close up over the gap the run leaves, opening
+    // one next to "after"; only the stops on the shorter side of the cycle have to shift
+    int nForward = m_positions[after] - start - length + 1;    // past the run up to after
+    if (nForward <= 0)
+        nForward += m_nLocations;
+    int nBackward = m_nLocations - length - nForward;           // past after up to the run
+    int runStart;
+    if (nForward <= nBackward) {
+        for (int i = 0; i < nForward; i++)
+            place(start + i, m_tour[(start + length + i) % m_nLocations]);
+        runStart = start + nForward;
+    }
+    else {
+        for (int i = 1; i <= nBackward; i++)
+            place(start + length - i + m_nLocations, m_tour[(start - i + m_nLocations) % m_nLocations]);
+        runStart = start - nBackward + m_nLocations;
+    }
+    for (int i = 0; i < length; i++)
+        place(runStart + i, segment[i]);
+}
+
+// put location at position, wrapping round the end of the tour
+void TourBuilder::place(int position, int location)
+{
+    position %= m_nLocations;
+    m_tour[position] = location;
+    m_positions[location] = position;
+}
+
+// Splits stops among a fleet of vehicles that all start and end at the depot (location 0),
+// each carrying at most a given load, keeping the total distance driven short.
+//
+// The stops are swept up by bearing from the depot, starting after the widest gap between
+// bearings, and dealt out to the vehicles in turn in runs of about equal load, so each
+// vehicle starts with one wedge around the depot. Each route is put in order with a
+// TourBuilder, and then stops are traded between routes: a stop is moved onto another
+// route next to one of its closest stops (relocate), or swapped with one of its closest
+// stops on another route (exchange), whenever that shortens the total without taking any
+// vehicle over its capacity. The same don't-look bits as TourBuilder's keep this to the
+// parts of the fleet that changed. Then each route is improved again on its own, in
+// parallel since the routes are independent, and trading and reordering alternate until
+// neither shortens the total or the time budget runs out. Every search shares the one
+// deadline, however many rounds or routes there are.
+class FleetBuilder
+{
+public:
+    FleetBuilder(const vector<GeoCoord>& locations, const vector<double>* roadDistances, const vector<double>& loads);
+    bool sweep(int nVehicles, double capacity);
+    void improve(double timeBudget);
+    
+    // stops of each vehicle in order, not counting the depot
+    const vector<vector<int>>& getRoutes() const;
+    
+private:
+    const vector<GeoCoord>& m_locations;
+    const vector<double>* m_roadDistances;  // row by row, or nullptr to use crow distance
+    const vector<double>& m_loads;                  // load of each location (the depot's is 0)
+    CoordTable m_coords;                             // built only for crow distance
+    int m_nLocations;
+    double m_capacity;
+    vector<vector<int>> m_routes;
+    vector<double> m_routeLoads;
+    vector<int> m_routeOf;              // route each stop is on
+    vector<int> m_positionOf;           // and where on it
+    vector<vector<int>> m_neighbors;    // closest locations to each, closest first
+    vector<vector<double>> m_neighborDistances;
+    vector<bool> m_queued;              // stop is waiting in m_queue to be looked at
+    vector<int> m_queue;
+    int m_queueHead;
+    
+    // Helper Functions
+    double distance(int a, int b) const;
+    int before(int stop) const;
+    int after(int stop) const;
+    void renumber(int route);
+    bool orderRoutes(chrono::steady_clock::time_point deadline, bool fromCurrentOrder);
+    bool tradeStops(chrono::steady_clock::time_point deadline);
+    void insertCheapest(int stop);
+    void wake(int location);
+    bool relocate(int a);
+    bool exchange(int a);
+};
+
+FleetBuilder::FleetBuilder(const vector<GeoCoord>& locations, const vector<double>* roadDistances, const vector<double>& loads)
+:   m_locations(locations), m_roadDistances(roadDistances), m_loads(loads), m_nLocations(locations.size()),
+    m_capacity(0), m_queueHead(0)
+{
+    if (m_roadDistances == nullptr) {
+        vector<double> latitudes;
+        vector<double> longitudes;
+        for (int i = 0; i < m_nLocations; i++) {
+            latitudes.push_back(m_locations[i].latitude);
+            longitudes.push_back(m_locations[i].longitude);
+        }
+        m_coords.build(latitudes, longitudes);
+    }
+}
+
+bool FleetBuilder::sweep(int nVehicles, double capacity)
+{
+    m_capacity = capacity;
+    m_routes.assign(nVehicles, vector<int>());
+    m_routeLoads.assign(nVehicles, 0);
+    m_routeOf.assign(m_nLocations, -1);
+    m_positionOf.assign(m_nLocations, -1);
+    
+    // no vehicle can take a stop heavier than it can carry
+    double total = 0;
+    for (int s = 1; s < m_nLocations; s++) {
+        if (m_loads[s] > capacity)
+            return false;
+        total += m_loads[s];
+    }
+    
+    // bearing of every stop from the depot, on a plane scaled to the depot's latitude
+    const double pi = 3.14159265358979323846;
+    double scale = cos(m_locations[0].latitude * pi / 180);
+    vector<pair<double, int>> bearings;
+    for (int s = 1; s < m_nLocations; s++) {
+        double dy = m_locations[s].latitude - m_locations[0].latitude;
+        double dx = (m_locations[s].longitude - m_locations[0].longitude) * scale;
+        bearings.push_back(make_pair(atan2(dy, dx), s));
+    }
+    sort(bearings.begin(), bearings.end());
+    
+    // start the sweep just after the widest gap, so no wedge straddles it
+    int nStops = bearings.size();
+    int start = 0;
+    double widestGap = -1;
+    for (int i = 0; i < nStops; i++) {
+        double gap = i == 0 ? bearings[0].first + 2 * pi - bearings[nStops - 1].first : bearings[i].first - bearings[i - 1].first;
+        if (gap > widestGap) {
+            widestGap = gap;
+            start = i;
+        }
+    }
+    
+    // deal the stops out in order, moving on to the next vehicle once one has its share or
+    // is full; whatever the last vehicle cannot take is fitted in wherever there is room
+    double share = total / nVehicles;
+    int vehicle = 0;
+    vector<int> leftOver;
+    for (int i = 0; i < nStops; i++) {
+        int s = bearings[(start + i) % nStops].second;
+        bool full = m_routeLoads[vehicle] + m_loads[s] > capacity || m_routeLoads[vehicle] >= share;
+        if (full && vehicle + 1 < nVehicles && !m_routes[vehicle].empty())
+            vehicle++;
+        if (m_routeLoads[vehicle] + m_loads[s] > capacity) {
+            leftOver.push_back(s);
+            continue;
+        }
+        m_routes[vehicle].push_back(s);
+        m_routeLoads[vehicle] += m_loads[s];
+    }
+    for (int r = 0; r < nVehicles; r++)
+        renumber(r);
+    for (int s : leftOver) {
+        insertCheapest(s);
+        if (m_routeOf[s] == -1)
+            return false;
+    }
+    return true;
+}
+
+void FleetBuilder::improve(double timeBudget)
+{
+    chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+    chrono::steady_clock::time_point deadline = deadlineAfter(timeBudget);
+    
+    // order each wedge first, within a quarter of the budget, so trading stops is judged on
+    // sensible routes
+    orderRoutes(startTime + (deadline - startTime) / 4, false);
+    findClosest(m_locations, m_roadDistances, m_coords, NEIGHBOR_COUNT, m_neighbors, m_neighborDistances);
+    
+    // then trade stops between routes and reorder each route in turn, until a round gains
+    // nothing or the time is up
+    for (;;) {
+        bool traded = tradeStops(deadline);
+        bool reordered = orderRoutes(deadline, true);
+        if ((!traded && !reordered) || chrono::steady_clock::now() > deadline)
+            break;
+    }
+}
+
+const vector<vector<int>>& FleetBuilder::getRoutes() const
+{
+    return m_routes;
+}
+
+double FleetBuilder::distance(int a, int b) const
+{
+    if (m_roadDistances != nullptr)
+        return (*m_roadDistances)[(long long)a * m_nLocations + b];
+    return m_coords.miles(a, b);
+}
+
+// the location before stop on its route (the depot if it is the first)
+int FleetBuilder::before(int stop) const
+{
+    int position = m_positionOf[stop];
+    return position == 0 ? 0 : m_routes[m_routeOf[stop]][position - 1];
+}
+
+// the location after stop on its route (the depot if it is the last)
+int FleetBuilder::after(int stop) const
+{
+    const vector<int>& route = m_routes[m_routeOf[stop]];
+    int position = m_positionOf[stop];
+    return position + 1 == route.size() ? 0 : route[position + 1];
+}
+
+void FleetBuilder::renumber(int route)
+{
+    for (int i = 0; i < m_routes[route].size(); i++) {
+        m_routeOf[m_routes[route][i]] = route;
+        m_positionOf[m_routes[route][i]] = i;
+    }
+}
+
+// put each route in a good order on its own, all routes at once, every one stopping by
+// deadline; returns whether any route got shorter
+bool FleetBuilder::orderRoutes(chrono::steady_clock::time_point deadline, bool fromCurrentOrder)
+{
+    vector<char> shortened(m_routes.size(), false);
+    ThreadPool& pool = ThreadPool::shared();
+    pool.parallelFor(m_routes.size(), [&](int r) {
+        vector<int>& route = m_routes[r];
+        if (route.size() < 2)
+            return;
+        
+        // a tour through the depot and this route's stops, numbered in route order
+        int n = route.size() + 1;
+        vector<GeoCoord> locations(1, m_locations[0]);
+        for (int s : route)
+            locations.push_back(m_locations[s]);
+        vector<double> roadDistances;
+        if (m_roadDistances != nullptr) {
+            roadDistances.resize((long long)n * n);
+            for (int i = 0; i < n; i++) {
+                long long from = (long long)(i == 0 ? 0 : route[i - 1]) * m_nLocations;
+                for (int j = 0; j < n; j++)
+                    roadDistances[(long long)i * n + j] = (*m_roadDistances)[from + (j == 0 ? 0 : route[j - 1])];
+            }
+        }
+        TourBuilder builder(locations, m_roadDistances != nullptr ? &roadDistances : nullptr);
+        if (fromCurrentOrder) {
+            vector<int> tour;
+            for (int i = 0; i < n; i++)
+                tour.push_back(i);
+            builder.setTour(tour);
+        }
+        else
+            builder.buildNearestNeighbor();
+        shortened[r] = builder.improveUntil(deadline);
+        
+        vector<int> tour;
+        builder.getTour(tour);
+        vector<int> ordered;
+        for (int i = 1; i < n; i++)
+            ordered.push_back(route[tour[i] - 1]);
+        route.swap(ordered);
+    });
+    for (int r = 0; r < m_routes.size(); r++)
+        renumber(r);
+    return find(shortened.begin(), shortened.end(), true) != shortened.end();
+}
+
+// move and swap stops between routes until no trade helps or deadline passes; returns
+// whether the total got shorter
+bool FleetBuilder::tradeStops(chrono::steady_clock::time_point deadline)
+{
+    m_queue.clear();
+    m_queueHead = 0;
+    m_queued.assign(m_nLocations, false);
+    for (int s = 1; s < m_nLocations; s++)
+        wake(s);
+    bool traded = false;
+    int nLooked = 0;
+    while (m_queueHead < m_queue.size()) {
+        // reading the clock costs more than a look at one stop, so only do it now and then
+        if (++nLooked % 64 == 0 && chrono::steady_clock::now() > deadline)
+            break;
+        int a = m_queue[m_queueHead++];
+        m_queued[a] = false;
+        if (relocate(a) || exchange(a)) {
+            wake(a);
+            traded = true;
+        }
+        
+        // reuse the front of the queue once it has all been looked at
+        if (m_queueHead > m_nLocations && m_queueHead * 2 > m_queue.size()) {
+            m_queue.erase(m_queue.begin(), m_queue.begin() + m_queueHead);
+            m_queueHead = 0;
+        }
+    }
+    return traded;
+}
+
+// add stop where it lengthens a route with room for it the least; it is left off every
+// route if none has room
+void FleetBuilder::insertCheapest(int stop)
+{
+    int bestRoute = -1;
+    int bestPosition = 0;
+    double bestCost = numeric_limits<double>::infinity();
+    for (int r = 0; r < m_routes.size(); r++) {
+        if (m_routeLoads[r] + m_loads[stop] > m_capacity)
+            continue;
+        const vector<int>& route = m_routes[r];
+        for (int i = 0; i <= route.size(); i++) {
+            int x = i == 0 ? 0 : route[i - 1];
+            int y = i == route.size() ? 0 : route[i];
+            double cost = distance(x, stop) + distance(stop, y) - distance(x, y);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestRoute = r;
+                bestPosition = i;
+            }
+        }
+    }
+    if (bestRoute == -1)
+        return;
+    m_routes[bestRoute].insert(m_routes[bestRoute].begin() + bestPosition, stop);
+    m_routeLoads[bestRoute] += m_loads[stop];
+    renumber(bestRoute);
+}
+
+void FleetBuilder::wake(int location)
+{
+    // the depot is on every route, and is never moved
+    if (location != 0 && !m_queued[location]) {
+        m_queued[location] = true;
+        m_queue.push_back(location);
+    }
+}
+
+bool FleetBuilder::relocate(int a)
+{
+    // what taking a off its route saves
+    int ra = m_routeOf[a];
+    int pa = before(a);
+    int na = after(a);
+    double removeGain = distance(pa, a) + distance(a, na) - distance(pa, na);
+    
+    // try putting it next to each close stop on another route with room for it
+    for (int c : m_neighbors[a]) {
+        if (c == 0)
+            continue;
+        int rc = m_routeOf[c];
+        if (rc == ra || m_routeLoads[rc] + m_loads[a] > m_capacity)
+            continue;
+        for (int side = 0; side < 2; side++) {
+            int x = side == 0 ? before(c) : c;
+            int y = side == 0 ? c : after(c);
+            double insertCost = distance(x, a) + distance(a, y) - distance(x, y);
+            if (removeGain - insertCost <= MIN_GAIN)
+                continue;
+            
+            int position = m_positionOf[c] + side;
+            m_routes[ra].erase(m_routes[ra].begin() + m_positionOf[a]);
+            m_routes[rc].insert(m_routes[rc].begin() + position, a);
+            m_routeLoads[ra] -= m_loads[a];
+            m_routeLoads[rc] += m_loads[a];
+            renumber(ra);
+            renumber(rc);
+            wake(pa);
+            wake(na);
+            wake(x);
+            wake(y);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FleetBuilder::exchange(int a)
+{
+    // try swapping a with each close stop on another route, if both routes can carry the result
+    int ra = m_routeOf[a];
+    int pa = before(a);
+    int na = after(a);
+    for (int c : m_neighbors[a]) {
+        if (c == 0)
+            continue;
+        int rc = m_routeOf[c];
+        if (rc == ra)
+            continue;
+        if (m_routeLoads[ra] - m_loads[a] + m_loads[c] > m_capacity || m_routeLoads[rc] - m_loads[c] + m_loads[a] > m_capacity)
+            continue;
+        int pc = before(c);
+        int nc = after(c);
+        double gain = distance(pa, a) + distance(a, na) - distance(pa, c) - distance(c, na)
+                    + distance(pc, c) + distance(c, nc) - distance(pc, a) - distance(a, nc);
+        if (gain <= MIN_GAIN)
+            continue;
+        
+        swap(m_routes[ra][m_positionOf[a]], m_routes[rc][m_positionOf[c]]);
+        swap(m_positionOf[a], m_positionOf[c]);
+        swap(m_routeOf[a], m_routeOf[c]);
+        m_routeLoads[ra] += m_loads[c] - m_loads[a];
+        m_routeLoads[rc] += m_loads[a] - m_loads[c];
+        wake(c);
+        wake(pa);
+        wake(na);
+        wake(pc);
+        wake(nc);
+        return true;
+    }
+    return false;
+}
 
 class DeliveryOptimizerImpl
 {
@@ -16,12 +838,25 @@ public:
         vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,
         double& newCrowDistance) const;
+    bool optimizeFleetDeliveries(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        const vector<double>& loads,
+        int nVehicles,
+        double capacity,
+        vector<vector<DeliveryRequest>>& vehicleDeliveries) const;
+    void setTimeBudget(double seconds);
 private:
     const StreetMap* m_StreetMap;
+    PointToPointRouter m_router;
+    double m_timeBudget;
+    
+    // Helper Function
+    bool computeRoadDistances(const vector<GeoCoord>& locations, vector<double>& roadDistances) const;
 };
 
 DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm)
-:   m_StreetMap(sm)
+:   m_StreetMap(sm), m_router(sm), m_timeBudget(numeric_limits<double>::infinity())
 {
 }
 
@@ -35,47 +870,35 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
     double& oldCrowDistance,
     double& newCrowDistance) const
 {
+    oldCrowDistance = 0;
+    newCrowDistance = 0;
+    if (deliveries.empty())
+        return;
+    
     // calculate the old crow distance, going between each delivery point
     oldCrowDistance = distanceEarthMiles(depot, deliveries[0].location);
     for (int i = 1; i < deliveries.size(); i++)
         oldCrowDistance += distanceEarthMiles(deliveries[i - 1].location, deliveries[i].location);
     oldCrowDistance += distanceEarthMiles(deliveries[deliveries.size()-1].location, depot);
     
-    // create vector of delivery locations, will be ordered correctly
-    vector<DeliveryRequest> newOrder;
+    // location 0 is the depot and location i + 1 is deliveries[i]
+    vector<GeoCoord> locations;
+    locations.push_back(depot);
+    for (int i = 0; i < deliveries.size(); i++)
+        locations.push_back(deliveries[i].location);
+    vector<double> roadDistances;
+    bool useRoads = computeRoadDistances(locations, roadDistances);
     
-    // order the delivery locations based on proximity to one another, keep adding the location that is closest to the current one
-    // finally, return to the depot from the final location
-    GeoCoord current = depot;
-    double shortestFromDepot = distanceEarthMiles(depot, deliveries[0].location);
-    int shortestFromDepotLocationNumber = 0;
-    for (int i = 1; i < deliveries.size(); i++) {
-        double currentDistance = distanceEarthMiles(depot, deliveries[i].location);
-        if (currentDistance < shortestFromDepot) {
-            shortestFromDepot = currentDistance;
-            shortestFromDepotLocationNumber = i;
-        }
-    }
-    newOrder.push_back(deliveries[shortestFromDepotLocationNumber]);
-    current = deliveries[shortestFromDepotLocationNumber].location;
-    deliveries.erase(deliveries.begin() + shortestFromDepotLocationNumber);
-    
-    // add the other locations necessary
-    while (deliveries.size() > 1) {
-        double shortestDistance = distanceEarthMiles(current, deliveries[0].location);
-        int shortestDistancePosition = 0;
-        for (int i = 1; i < deliveries.size(); i++) {
-            double currentDistance = distanceEarthMiles(current, deliveries[i].location);
-            if (currentDistance < shortestDistance) {
-                shortestDistance = currentDistance;
-                shortestDistancePosition = i;
-            }
-        }
-        newOrder.push_back(deliveries[shortestDistancePosition]);
-        current = deliveries[shortestDistancePosition].location;
-        deliveries.erase(deliveries.begin() + shortestDistancePosition);
-    }
-    newOrder.push_back(deliveries[0]);
+    // build a tour and improve it for as long as we are allowed
+    TourBuilder builder(locations, useRoads ? &roadDistances : nullptr);
+    builder.buildNearestNeighbor();
+    builder.improve(m_timeBudget);
+    vector<int> tour;
+    builder.getTour(tour);
+    
+    vector<DeliveryRequest> newOrder;
+    for (int i = 1; i < tour.size(); i++)
+        newOrder.push_back(deliveries[tour[i] - 1]);
     deliveries = newOrder;
     
     // calculate the new crow distance, going between each delivery point
@@ -85,6 +908,77 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
     newCrowDistance += distanceEarthMiles(deliveries[deliveries.size()-1].location, depot);
 }
 
+bool DeliveryOptimizerImpl::optimizeFleetDeliveries(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const vector<double>& loads,
+    int nVehicles,
+    double capacity,
+    vector<vector<DeliveryRequest>>& vehicleDeliveries) const
+{
+    vehicleDeliveries.clear();
+    if (nVehicles <= 0 || (!loads.empty() && loads.size() != deliveries.size()))
+        return false;
+    vehicleDeliveries.resize(nVehicles);
+    if (deliveries.empty())
+        return true;
+    
+    // location 0 is the depot and location i + 1 is deliveries[i], which weighs loads[i]
+    // (or 1, when no loads are given, so the capacity is a number of stops)
+    vector<GeoCoord> locations;
+    vector<double> locationLoads;
+    locations.push_back(depot);
+    locationLoads.push_back(0);
+    for (int i = 0; i < deliveries.size(); i++) {
+        locations.push_back(deliveries[i].location);
+        locationLoads.push_back(loads.empty() ? 1 : loads[i]);
+    }
+    vector<double> roadDistances;
+    bool useRoads = computeRoadDistances(locations, roadDistances);
+    
+    // split the stops among the vehicles and improve the split for as long as we are allowed
+    FleetBuilder builder(locations, useRoads ? &roadDistances : nullptr, locationLoads);
+    if (!builder.sweep(nVehicles, capacity)) {
+        vehicleDeliveries.clear();
+        return false;
+    }
+    builder.improve(m_timeBudget);
+    
+    const vector<vector<int>>& routes = builder.getRoutes();
+    for (int v = 0; v < nVehicles; v++) {
+        for (int s : routes[v])
+            vehicleDeliveries[v].push_back(deliveries[s - 1]);
+    }
+    return true;
+}
+
+void DeliveryOptimizerImpl::setTimeBudget(double seconds)
+{
+    m_timeBudget = seconds;
+}
+
+// measure between stops in road distance where that is affordable: for up to
+// HIERARCHY_ROAD_DISTANCE_STOP_LIMIT stops if the map has a contraction hierarchy, otherwise
+// for up to ROAD_DISTANCE_STOP_LIMIT; returns false if crow distance should be used instead
+bool DeliveryOptimizerImpl::computeRoadDistances(const vector<GeoCoord>& locations, vector<double>& roadDistances) const
+{
+    int stopLimit = m_StreetMap->getHierarchy() != nullptr ? HIERARCHY_ROAD_DISTANCE_STOP_LIMIT : ROAD_DISTANCE_STOP_LIMIT;
+    if (locations.size() > stopLimit + 1)
+        return false;
+    if (m_router.computeDistanceMatrix(locations, roadDistances) != DELIVERY_SUCCESS)
+        return false;
+    
+    // a stop that cannot be reached gives no planable route anyway, and infinite
+    // distances would upset the local search, so fall back to crow distance then
+    for (double d : roadDistances) {
+        if (d == numeric_limits<double>::infinity()) {
+            roadDistances.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
 //******************** DeliveryOptimizer functions ****************************
 
 // These functions simply delegate to DeliveryOptimizerImpl's functions.
@@ -108,3 +1002,19 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
 {
     return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
 }
+
+void DeliveryOptimizer::setTimeBudget(double seconds)
+{
+    m_impl->setTimeBudget(seconds);
+}
+
+bool DeliveryOptimizer::optimizeFleetDeliveries(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        const vector<double>& loads,
+        int nVehicles,
+        double capacity,
+        vector<vector<DeliveryRequest>>& vehicleDeliveries) const
+{
+    return m_impl->optimizeFleetDeliveries(depot, deliveries, loads, nVehicles, capacity, vehicleDeliveries);
+}
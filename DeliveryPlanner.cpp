@@ -1,7 +1,36 @@
 #include "provided.h"
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include "ThreadPool.h"
+#include "RouteEngine.h"
+
 using namespace std;
 
+// which way a segment heads, in eighths of the compass, and which way a change of street
+// turns; they are worked out for every segment, so they stay numbers and are only spelled
+// out (by the tables below) when a command is made
+enum Heading : int
+{
+    HEADING_EAST, HEADING_NORTHEAST, HEADING_NORTH, HEADING_NORTHWEST,
+    HEADING_WEST, HEADING_SOUTHWEST, HEADING_SOUTH, HEADING_SOUTHEAST
+};
+
+enum Turn : int
+{
+    TURN_LEFT, TURN_RIGHT, TURN_NONE
+};
+
+const char* const HEADING_NAMES[] = {
+    "east", "northeast", "north", "northwest", "west", "southwest", "south", "southeast"
+};
+const char* const TURN_NAMES[] = { "left", "right", "error" };
+
+// fewest legs to or from the depot for which one search from the depot, reaching every
+// stop at once, beats searching for the legs one by one. Only fleet plans get there: a
+// single plan has just two depot legs, which A* finds several times faster than the tree
+const int DEPOT_TREE_MIN_LEGS = 8;
+
 class DeliveryPlannerImpl
 {
 public:
@@ -12,16 +41,37 @@ public:
         const vector<DeliveryRequest>& deliveries,
         vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+    DeliveryResult generateFleetDeliveryPlans(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        const vector<double>& loads,
+        int nVehicles,
+        double capacity,
+        vector<vector<DeliveryCommand>>& vehicleCommands,
+        vector<double>& vehicleDistances) const;
+    void setSnapDistance(double miles);
+    void setRouteCaching(bool enabled);
 private:
     const StreetMap* m_StreetMap;
+    double m_snapDistance;  // passed on to the routers
+    bool m_routeCaching;    // likewise
     
-    // Helper Function
-    string turn(double angle) const;
-    string direction(double angle) const;
+    // Helper Functions
+    DeliveryResult planRoute(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& targetDeliveries,
+        vector<DeliveryCommand>& commands,
+        double& totalDistanceTravelled,
+        const ShortestPathTree* depotTree = nullptr,
+        int firstTarget = -1,
+        int lastTarget = -1) const;
+    Turn turn(double angle) const;
+    Heading direction(double angle) const;
+    double angleOf(int from, int to) const;
 };
 
 DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm)
-:   m_StreetMap(sm)
+:   m_StreetMap(sm), m_snapDistance(0), m_routeCaching(false)
 {
 }
 
@@ -51,91 +101,184 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     DeliveryOptimizer optimizer(m_StreetMap);
     optimizer.optimizeDeliveryOrder(depot, targetDeliveries, oldCrowDistance, newCrowDistance);
     
+    return planRoute(depot, targetDeliveries, commands, totalDistanceTravelled);
+}
+
+DeliveryResult DeliveryPlannerImpl::generateFleetDeliveryPlans(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const vector<double>& loads,
+    int nVehicles,
+    double capacity,
+    vector<vector<DeliveryCommand>>& vehicleCommands,
+    vector<double>& vehicleDistances) const
+{
+    vehicleCommands.clear();
+    vehicleDistances.clear();
     
-    // Generate point to point routes between depot and through each delivery location and back to depot (use the PointToPointRouter class)
-    PointToPointRouter router(m_StreetMap);
+    // split the deliveries among the vehicles, each in order; if they cannot be split
+    // without overloading a vehicle, there is no plan
+    vector<vector<DeliveryRequest>> vehicleDeliveries;
+    DeliveryOptimizer optimizer(m_StreetMap);
+    if (!optimizer.optimizeFleetDeliveries(depot, deliveries, loads, nVehicles, capacity, vehicleDeliveries))
+        return NO_ROUTE;
     
-    vector<list<StreetSegment>> routes;
-    list<StreetSegment> currentRoute;
-    double currentDistanceTravelled;
+    // every vehicle leaves the depot for its first delivery and comes back from its last;
+    // with enough vehicles, one search from the depot finds all of those legs (targets 2v
+    // and 2v + 1 of the tree are vehicle v's first and last delivery)
+    vector<GeoCoord> ends;
+    int nDepotLegs = 0;
+    for (int v = 0; v < nVehicles; v++) {
+        if (vehicleDeliveries[v].empty()) {
+            ends.push_back(depot);
+            ends.push_back(depot);
+            continue;
+        }
+        ends.push_back(vehicleDeliveries[v].front().location);
+        ends.push_back(vehicleDeliveries[v].back().location);
+        nDepotLegs += 2;
+    }
+    ShortestPathTree depotTree;
+    bool useTree = nDepotLegs >= DEPOT_TREE_MIN_LEGS;
+    if (useTree) {
+        PointToPointRouter router(m_StreetMap);
+        router.setSnapDistance(m_snapDistance);
+        DeliveryResult result = router.buildShortestPathTree(depot, ends, depotTree);
+        if (result != DELIVERY_SUCCESS)
+            return result;
+    }
     
-    // check to see if the path from the depot to first delivery location is valid
-    DeliveryResult result = router.generatePointToPointRoute(depot, deliveries[0].location, currentRoute, currentDistanceTravelled);
-    if (result == BAD_COORD)
-        return BAD_COORD;
-    if (result == NO_ROUTE)
-        return NO_ROUTE;
-    routes.push_back(currentRoute);
+    // plan each vehicle's route as it is (its legs are routed in parallel); a vehicle with
+    // nothing to deliver stays at the depot
+    vehicleCommands.resize(nVehicles);
+    vehicleDistances.assign(nVehicles, 0);
+    for (int v = 0; v < nVehicles; v++) {
+        if (vehicleDeliveries[v].empty())
+            continue;
+        DeliveryResult result = planRoute(depot, vehicleDeliveries[v], vehicleCommands[v], vehicleDistances[v],
+                                          useTree ? &depotTree : nullptr, 2 * v, 2 * v + 1);
+        if (result != DELIVERY_SUCCESS) {
+            vehicleCommands.clear();
+            vehicleDistances.clear();
+            return result;
+        }
+    }
+    return DELIVERY_SUCCESS;
+}
+
+// route from the depot through the deliveries in the order given and back, and describe
+// the way as commands; if depotTree is given, the first and last leg are read off it
+// (as its targets firstTarget and lastTarget) instead of being searched for
+DeliveryResult DeliveryPlannerImpl::planRoute(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& targetDeliveries,
+    vector<DeliveryCommand>& commands,
+    double& totalDistanceTravelled,
+    const ShortestPathTree* depotTree,
+    int firstTarget,
+    int lastTarget) const
+{
+    commands.clear();
+    
+    // Generate point to point routes between depot and through each delivery location and back to depot (use the PointToPointRouter class)
+    // leg 0 goes from the depot to the first delivery, leg i from delivery i - 1 to delivery i,
+    // and the last leg from the final delivery back to the depot
+    int nLegs = targetDeliveries.size() + 1;
+    vector<GeoCoord> stops;
+    stops.push_back(depot);
+    for (int i = 0; i < targetDeliveries.size(); i++)
+        stops.push_back(targetDeliveries[i].location);
+    stops.push_back(depot);
+    
+    // the legs do not depend on each other, so route them in parallel; each block of legs
+    // gets its own router (a router must not be shared between threads), and every leg is
+    // routed straight into its own place in routes. With route caching on, legs planned
+    // before on this map, by any planner, come from the map's route cache
+    vector<CompactRoute> routes(nLegs);
+    vector<DeliveryResult> results(nLegs);
+    ThreadPool& pool = ThreadPool::shared();
+    int nBlocks = min(nLegs, pool.size());
+    pool.parallelFor(nBlocks, [&](int b) {
+        PointToPointRouter router(m_StreetMap);
+        router.setSnapDistance(m_snapDistance);
+        router.setRouteCaching(m_routeCaching);
+        for (int leg = b; leg < nLegs; leg += nBlocks) {
+            if (depotTree != nullptr && leg == 0)
+                results[leg] = router.generateRouteFromSource(*depotTree, firstTarget, routes[leg]);
+            else if (depotTree != nullptr && leg == nLegs - 1)
+                results[leg] = router.generateRouteToSource(*depotTree, lastTarget, routes[leg]);
+            else
+                results[leg] = router.generatePointToPointRoute(stops[leg], stops[leg + 1], routes[leg]);
+        }
+    });
     
-    // check to see if paths between each delivery location are valid
-    for (int i = 0; i < targetDeliveries.size() - 1; i++) {
-        result = router.generatePointToPointRoute(targetDeliveries[i].location, targetDeliveries[i+1].location, currentRoute, currentDistanceTravelled);
-        if (result == BAD_COORD)
+    // check to see if every path is valid, reporting the first leg that is not
+    for (int leg = 0; leg < nLegs; leg++) {
+        if (results[leg] == BAD_COORD)
             return BAD_COORD;
-        if (result == NO_ROUTE)
+        if (results[leg] == NO_ROUTE)
             return NO_ROUTE;
-        routes.push_back(currentRoute);
     }
     
-    // check to see if path from final delivery location to depot is valid
-    result = router.generatePointToPointRoute(targetDeliveries[targetDeliveries.size() - 1].location, depot, currentRoute, currentDistanceTravelled);
-    if (result == BAD_COORD)
-        return BAD_COORD;
-    if (result == NO_ROUTE)
-        return NO_ROUTE;
-    routes.push_back(currentRoute);
-    
     // before starting the delivery process, total distance is reset to zero
     totalDistanceTravelled = 0;
     
-    // loop through each route we will be taking
+    // loop through each route we will be taking; routes are edge ids, so streets are told
+    // apart by id and a street's name is only spelled out when a command mentions it
+    const StreetGraph* graph = m_StreetMap->getGraph();
     for (int i = 0; i < routes.size(); i ++) {
-        list<StreetSegment> currentRoute = routes[i];
+        const CompactRoute& currentRoute = routes[i];
         
         // loop through the current route
-        StreetSegment* prev = nullptr;
-        string prevStreet = "";
+        int from = currentRoute.start;
+        int prevStreet = -1;
+        double prevAngle = 0;
         double currentDistance = 0;
-        string currentDirection;
-        for (list<StreetSegment>::iterator p = currentRoute.begin(); p != currentRoute.end(); p++) {
+        Heading currentDirection = HEADING_EAST;
+        for (int e : currentRoute.edges) {
 
             // determine some features of the current route
-            currentDirection = direction(angleOfLine(*p));
-            string currentStreet = (*p).name;
-            double segmentDistance = distanceEarthMiles((*p).start, (*p).end);
+            int to = graph->getEdgeTarget(e);
+            double currentAngle = angleOf(from, to);
+            currentDirection = direction(currentAngle);
+            int currentStreet = graph->getEdgeStreet(e);
+            double segmentDistance = graph->distanceMiles(from, to);
             
-            if (prev != nullptr) {
+            if (prevStreet != -1) {
 
                 if (prevStreet == currentStreet) {
-                    currentDistance += distanceEarthMiles(prev->end, (*p).end);
+                    currentDistance += segmentDistance;
                 }
                 else {
-                    string currentTurn = turn(angleBetween2Lines(*p, *prev));
-                    if (currentTurn != "error") {
+                    // the angle from this segment to the previous one, as angleBetween2Lines measures it
+                    double between = prevAngle - currentAngle;
+                    if (between < 0)
+                        between += 360;
+                    Turn currentTurn = turn(between);
+                    if (currentTurn != TURN_NONE) {
                         DeliveryCommand turnCommand;
-                        turnCommand.initAsTurnCommand(currentTurn, currentStreet);
+                        turnCommand.initAsTurnCommand(TURN_NAMES[currentTurn], graph->getStreetName(currentStreet));
                         commands.push_back(turnCommand);
                     }
                     DeliveryCommand proceedCommand;
-                    proceedCommand.initAsProceedCommand(currentDirection, prevStreet, currentDistance);
+                    proceedCommand.initAsProceedCommand(HEADING_NAMES[currentDirection], graph->getStreetName(prevStreet), currentDistance);
                     commands.push_back(proceedCommand);
                     currentDistance = 0;
                 }
             }
             else {
-                currentDistance = distanceEarthMiles((*p).start, (*p).end);
+                currentDistance = segmentDistance;
             }
 
             totalDistanceTravelled += segmentDistance;
-            prev = &(*p);
+            prevAngle = currentAngle;
             prevStreet = currentStreet;
-
-            
+            from = to;
         }
         
         if (currentDistance != 0) {
             DeliveryCommand proceedCommand;
-            proceedCommand.initAsProceedCommand(currentDirection, prevStreet, currentDistance);
+            proceedCommand.initAsProceedCommand(HEADING_NAMES[currentDirection], graph->getStreetName(prevStreet), currentDistance);
             commands.push_back(proceedCommand);
         }
         
@@ -152,36 +295,56 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     return DELIVERY_SUCCESS;
 }
 
+void DeliveryPlannerImpl::setSnapDistance(double miles)
+{
+    m_snapDistance = miles;
+}
+
+void DeliveryPlannerImpl::setRouteCaching(bool enabled)
+{
+    m_routeCaching = enabled;
+}
+
+// angle of the line from node from to node to, measured as angleOfLine measures a segment's
+double DeliveryPlannerImpl::angleOf(int from, int to) const
+{
+    const StreetGraph* graph = m_StreetMap->getGraph();
+    double angle = atan2(graph->getLatitude(to) - graph->getLatitude(from), graph->getLongitude(to) - graph->getLongitude(from)) * 180 / 3.14159265358979323846;
+    if (angle < 0)
+        angle += 360;
+    return angle;
+}
+
 // return whether or not the given angle is a left turn, right turn, or not turn at all
-string DeliveryPlannerImpl::turn(double angle) const {
+Turn DeliveryPlannerImpl::turn(double angle) const {
     if (angle >= 1 && angle < 180)
-        return "left";
+        return TURN_LEFT;
     else if (angle >= 180 && angle <= 359)
-        return "right";
+        return TURN_RIGHT;
     else
-        return "error";
+        return TURN_NONE;
 }
 
 // return the directional label for a given angle of movement
-string DeliveryPlannerImpl::direction(double angle) const {
+Heading DeliveryPlannerImpl::direction(double angle) const {
     if (angle >= 0 && angle < 22.5)
-        return "east";
+        return HEADING_EAST;
     else if (angle >= 22.5 && angle < 67.5)
-        return "northeast";
+        return HEADING_NORTHEAST;
     else if (angle >= 67.5 && angle < 112.5)
-        return "north";
+        return HEADING_NORTH;
     else if (angle >= 112.5 && angle < 157.5)
-        return "northwest";
+        return HEADING_NORTHWEST;
     else if (angle >= 157.5 && angle < 202.5)
-        return "west";
+        return HEADING_WEST;
     else if (angle >= 202.5 && angle < 247.5)
-        return "southwest";
+        return HEADING_SOUTHWEST;
     else if (angle >= 247.5 && angle < 292.5)
-        return "south";
+        return HEADING_SOUTH;
     else if (angle >= 292.5 && angle < 337.5)
-        return "southeast";
+        return HEADING_SOUTHEAST;
     else
-        return "east";
+        return HEADING_EAST;
 }
 
 
@@ -212,3 +375,25 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
 {
     return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
 }
+
+void DeliveryPlanner::setSnapDistance(double miles)
+{
+    m_impl->setSnapDistance(miles);
+}
+
+void DeliveryPlanner::setRouteCaching(bool enabled)
+{
+    m_impl->setRouteCaching(enabled);
+}
+
+DeliveryResult DeliveryPlanner::generateFleetDeliveryPlans(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const vector<double>& loads,
+    int nVehicles,
+    double capacity,
+    vector<vector<DeliveryCommand>>& vehicleCommands,
+    vector<double>& vehicleDistances) const
+{
+    return m_impl->generateFleetDeliveryPlans(depot, deliveries, loads, nVehicles, capacity, vehicleCommands, vehicleDistances);
+}
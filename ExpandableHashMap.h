@@ -2,24 +2,41 @@
 
 // ExpandableHashMap.h
 
-//#ifndef ExpandableHashMap
-//#define ExpandableHashMap
+#ifndef EXPANDABLEHASHMAP_INCLUDED
+#define EXPANDABLEHASHMAP_INCLUDED
 
 #include <vector>
-#include <list>
+#include <utility>
 #include "provided.h"
 
 using namespace std;
 
 const int INITIAL_NUMBER_OF_BUCKETS = 8;
 
+// Open addressing hash map with Robin Hood probing.
+//
+// All associations live in one flat array of buckets whose size is a power of two, so a
+// key's home bucket is its hash masked by (number of buckets - 1). A key that collides is
+// placed in the next free bucket, and while probing an incoming key takes the bucket of any
+// key that sits closer to its own home, which keeps every probe sequence short. Each bucket
+// remembers how far it is from its key's home (0 meaning empty) and the key's full hash, so
+// most mismatches are rejected without comparing keys.
+//
+// When the map grows it moves its associations into the new buckets rather than copying
+// them. With incrementalRehash set, the old buckets are kept after growing and a few of
+// them are moved by each later associate(), so no single call pays for moving the whole
+// map; find() looks in both sets of buckets until the move is done. reserve() sizes the
+// map up front so a known number of associations never triggers a rehash at all.
+//
+// Pointers returned by find() are only valid until the next call to associate().
 template<typename KeyType, typename ValueType>
 class ExpandableHashMap
 {
 public:
-    ExpandableHashMap(double maximumLoadFactor = 0.5);
+    ExpandableHashMap(double maximumLoadFactor = 0.5, bool incrementalRehash = false);
     ~ExpandableHashMap();
     void reset();
+    void reserve(int nAssociations);
     int size() const;
     void associate(const KeyType& key, const ValueType& value);
     unsigned int getBucketNumber(const KeyType& key) const;
@@ -35,37 +52,59 @@ public:
       // C++11 syntax for preventing copying and assignment
     ExpandableHashMap(const ExpandableHashMap&) = delete;
     ExpandableHashMap& operator=(const ExpandableHashMap&) = delete;
-    
-    
-    
+
+
+
     void print () const;
-    
+
 
 private:
     struct KeyAndValue {
-        KeyAndValue(KeyType key, ValueType value): m_KeyType(key), m_ValueType(value) {}
+        KeyAndValue(): m_KeyType(), m_ValueType() {}
+        KeyAndValue(const KeyType& key, const ValueType& value): m_KeyType(key), m_ValueType(value) {}
         KeyType m_KeyType;
         ValueType m_ValueType;
     };
 
-    vector<list<KeyAndValue>*>* m_buckets;
-    double m_nAssociations;
+    // longest probe distance a bucket can record before the map must grow
+    static const int MAXIMUM_PROBE_DISTANCE = 255;
+
+    vector<KeyAndValue> m_buckets;
+    vector<unsigned int> m_hashes;          // full hash of the key in each bucket
+    vector<unsigned char> m_distances;      // 1 + distance from the key's home bucket, 0 if empty
+    unsigned int m_mask;                    // number of buckets - 1
+    int m_nAssociations;
     double m_maximumLoadFactor;
 
+    // buckets from before the last growth that have not all been moved yet; every bucket
+    // below m_nextToMove has already been moved out, the rest are still searched by find()
+    vector<KeyAndValue> m_oldBuckets;
+    vector<unsigned int> m_oldHashes;
+    vector<unsigned char> m_oldDistances;
+    unsigned int m_oldMask;
+    int m_nextToMove;
+    bool m_incrementalRehash;
+    int m_bucketsToMovePerInsert;
+
     // Helper Functions
     void rehash();
+    void grow(int newSize, bool incremental);
+    void moveOldBuckets(int count);
     double currentLoadFactor() const;
-    
+    unsigned int hashOf(const KeyType& key) const;
+    void insert(unsigned int h, KeyAndValue entry);
+
 
 };
 
 template<typename KeyType, typename ValueType>
-ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFactor)
-:   m_maximumLoadFactor(maximumLoadFactor)
+ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFactor, bool incrementalRehash)
+:   m_maximumLoadFactor(maximumLoadFactor), m_incrementalRehash(incrementalRehash)
 {
-    // create new buckets
-    m_buckets = new vector<list<KeyAndValue>*>;
-    
+    // the map doubles once every (load factor * old buckets) new associations, so moving a
+    // little more than 1 / load factor old buckets per insert finishes before the next growth
+    m_bucketsToMovePerInsert = int(1 / maximumLoadFactor) + 2;
+
     // reset the buckets
     reset();
 }
@@ -73,35 +112,41 @@ ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFacto
 template<typename KeyType, typename ValueType>
 ExpandableHashMap<KeyType, ValueType>::~ExpandableHashMap()
 {
-    // loop through buckets and delete any present lists
-    for (int i = m_buckets->size() - 1; i >= 0; i--) {
-        (*m_buckets)[i]->clear();
-        if (!(*m_buckets)[i]->empty())
-            delete (*m_buckets)[i];
-    }
-    
-    // delete pointer to vector of buckets
-    delete m_buckets;
+    // the bucket vectors free themselves
 }
 
 template<typename KeyType, typename ValueType>
 void ExpandableHashMap<KeyType, ValueType>::reset()
 {
-    // loop through buckets and delete any present lines
-    for (int i = m_buckets->size() - 1; i >= 0; i--) {
-        (*m_buckets)[i]->clear();
-        if (!(*m_buckets)[i]->empty())
-            delete (*m_buckets)[i];
-    }
-
-    // add an initial amount of buckets
-    for (int i = 0; i < INITIAL_NUMBER_OF_BUCKETS; i++)
-        m_buckets->push_back(new list<KeyAndValue>);
+    // replace the buckets with an initial amount of empty buckets
+    m_buckets.assign(INITIAL_NUMBER_OF_BUCKETS, KeyAndValue());
+    m_hashes.assign(INITIAL_NUMBER_OF_BUCKETS, 0);
+    m_distances.assign(INITIAL_NUMBER_OF_BUCKETS, 0);
+    m_mask = INITIAL_NUMBER_OF_BUCKETS - 1;
+
+    // drop any buckets left over from an unfinished growth
+    vector<KeyAndValue>().swap(m_oldBuckets);
+    vector<unsigned int>().swap(m_oldHashes);
+    vector<unsigned char>().swap(m_oldDistances);
+    m_oldMask = 0;
+    m_nextToMove = 0;
 
     // reset number of associations to zero
     m_nAssociations = 0;
 }
 
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::reserve(int nAssociations)
+{
+    // find the smallest power of two number of buckets that holds nAssociations
+    // without going over the max load factor, and grow to it in one step
+    int newSize = m_buckets.size();
+    while (nAssociations > m_maximumLoadFactor * newSize)
+        newSize *= 2;
+    if (newSize > m_buckets.size())
+        grow(newSize, false);
+}
+
 template<typename KeyType, typename ValueType>
 int ExpandableHashMap<KeyType, ValueType>::size() const
 {
@@ -119,40 +164,51 @@ void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const
         return;
     }
 
-    // if key is not already in map, obtain bucket number it will be place in and add it to the bucket's list
-    unsigned int i = getBucketNumber(key);
-    (*m_buckets)[i]->push_back(KeyAndValue(key, value));
-    // increase number of associations
-    m_nAssociations++;
-
-    // check if max load factor has been exceeded
-    if (currentLoadFactor() > m_maximumLoadFactor)
+    // grow first if the new association would exceed the max load factor
+    if (m_nAssociations + 1 > m_maximumLoadFactor * m_buckets.size())
         rehash();
 
-    return;
+    // place the key in the buckets and increase number of associations
+    insert(hashOf(key), KeyAndValue(key, value));
+    m_nAssociations++;
+
+    // continue moving any buckets left over from the last growth
+    if (!m_oldBuckets.empty())
+        moveOldBuckets(m_bucketsToMovePerInsert);
 }
 
 template<typename KeyType, typename ValueType>
 unsigned int ExpandableHashMap<KeyType, ValueType>::getBucketNumber(const KeyType& key) const {
-    // find number of well distribution using hash function
-    unsigned int hasher(const KeyType& k);
-    unsigned int h = hasher(key);
-    // convert the found number into a particular bucket, given the total buckets present
-    return h % m_buckets->size();
-    return 0;
+    // the home bucket of a key is given by the low bits of its hash
+    return hashOf(key) & m_mask;
 }
 
 template<typename KeyType, typename ValueType>
 const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key) const
 {
-    // get the bucket number of given key
-    unsigned int i = getBucketNumber(key);
+    // start at the key's home bucket
+    unsigned int h = hashOf(key);
+    unsigned int i = h & m_mask;
 
-    // loop through the bucket's list
-    for (typename list<KeyAndValue>::iterator p = (*m_buckets)[i]->begin(); p != (*m_buckets)[i]->end(); p++) {
+    // walk forward until we reach a bucket whose key is closer to its home than we are to
+    // ours; Robin Hood placement guarantees the key would have been stored before that point
+    for (int distance = 1; m_distances[i] >= distance; distance++) {
         // if key is found, return the value it is mapped to
-        if ((*p).m_KeyType == key)
-            return &((*p).m_ValueType);
+        if (m_hashes[i] == h && m_buckets[i].m_KeyType == key)
+            return &m_buckets[i].m_ValueType;
+        i = (i + 1) & m_mask;
+    }
+
+    // while a growth is unfinished the key may still be in a bucket that has not been moved;
+    // moved buckets keep their distances so the probe sequence is still correct, but their
+    // contents are gone and must be skipped
+    if (!m_oldBuckets.empty()) {
+        i = h & m_oldMask;
+        for (int distance = 1; m_oldDistances[i] >= distance; distance++) {
+            if (i >= m_nextToMove && m_oldHashes[i] == h && m_oldBuckets[i].m_KeyType == key)
+                return &m_oldBuckets[i].m_ValueType;
+            i = (i + 1) & m_oldMask;
+        }
     }
 
     // if key was not found, return null
@@ -160,70 +216,148 @@ const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key)
 }
 
 template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::rehash() {
-    
-    // set old buckets to m_buckets
-    vector<list<KeyAndValue>*>* oldBuckets = m_buckets;
-
-    // determine the new size of m_buckets
-    int newSize = m_buckets->size() * 2;
-    
-    // set m_buckets to a new vector of buckets
-    m_buckets = new vector<list<KeyAndValue>*>;
-    // add the necessary amount of new buckets
-    for (int i = 0; i < newSize; i++) {
-        m_buckets->push_back(new list<KeyAndValue>);
-    }
-    
-    // loop through old buckets
-    for (int i = 0; i < oldBuckets->size(); i++) {
-        // loop through each bucket's list
-        for (typename list<KeyAndValue>::iterator p = (*oldBuckets)[i]->begin(); p != (*oldBuckets)[i]->end(); p++) {
-            // obtain key and value at each element of the list
-            KeyType k = (*p).m_KeyType;
-            ValueType v = (*p).m_ValueType;
-            // associate the key and value for m_buckets
-            associate(k, v);
+void ExpandableHashMap<KeyType, ValueType>::insert(unsigned int h, KeyAndValue entry)
+{
+    // the caller guarantees the key is not already present
+    unsigned int i = h & m_mask;
+    int distance = 1;
+    while (true) {
+        // an empty bucket ends the search
+        if (m_distances[i] == 0) {
+            m_buckets[i] = std::move(entry);
+            m_hashes[i] = h;
+            m_distances[i] = distance;
+            return;
+        }
+
+        // take the bucket from a key that is closer to its home, and carry that key on instead
+        if (m_distances[i] < distance) {
+            swap(m_buckets[i], entry);
+            swap(m_hashes[i], h);
+            unsigned char displaced = m_distances[i];
+            m_distances[i] = distance;
+            distance = displaced;
+        }
+
+        i = (i + 1) & m_mask;
+        distance++;
+
+        // a probe too long to record means the buckets are badly clustered, so grow them
+        // and start placing the key we are carrying over again
+        if (distance > MAXIMUM_PROBE_DISTANCE) {
+            rehash();
+            i = h & m_mask;
+            distance = 1;
         }
     }
-    
-    // loop through old buckets
-    for (int i = 0; i < oldBuckets->size(); i++) {
-        // delete every present list
-        if ((*oldBuckets)[i] != nullptr)
-            delete (*oldBuckets)[i];
+}
+
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::rehash() {
+    // double the number of buckets
+    grow(m_buckets.size() * 2, m_incrementalRehash);
+}
+
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::grow(int newSize, bool incremental) {
+
+    // only one set of old buckets is kept, so finish the previous growth first
+    if (!m_oldBuckets.empty())
+        moveOldBuckets(m_oldBuckets.size());
+
+    // set current buckets aside as the old buckets
+    m_oldBuckets.swap(m_buckets);
+    m_oldHashes.swap(m_hashes);
+    m_oldDistances.swap(m_distances);
+    m_oldMask = m_mask;
+    m_nextToMove = 0;
+
+    // create the new, empty buckets
+    m_buckets.assign(newSize, KeyAndValue());
+    m_hashes.assign(newSize, 0);
+    m_distances.assign(newSize, 0);
+    m_mask = newSize - 1;
+
+    // unless asked to spread the work over later inserts, move everything now
+    if (!incremental)
+        moveOldBuckets(m_oldBuckets.size());
+}
+
+template<typename KeyType, typename ValueType>
+void ExpandableHashMap<KeyType, ValueType>::moveOldBuckets(int count) {
+
+    // move the next count old buckets into the current buckets; their keys are known to be
+    // unique so they are placed directly with their stored hashes, without calling find()
+    for (int moved = 0; moved < count && m_nextToMove < m_oldBuckets.size(); moved++) {
+        // advance first so a growth triggered while placing this bucket does not move it twice
+        int i = m_nextToMove++;
+        if (m_oldDistances[i] != 0)
+            insert(m_oldHashes[i], std::move(m_oldBuckets[i]));
+    }
+
+    // once everything has been moved the old buckets can be released
+    if (m_nextToMove >= m_oldBuckets.size()) {
+        vector<KeyAndValue>().swap(m_oldBuckets);
+        vector<unsigned int>().swap(m_oldHashes);
+        vector<unsigned char>().swap(m_oldDistances);
+        m_nextToMove = 0;
     }
-    // delete vector of old buckets
-    delete oldBuckets;
 }
 
 template<typename KeyType, typename ValueType>
 double ExpandableHashMap<KeyType, ValueType>::currentLoadFactor() const {
     // calculate and return current load factor
-    return m_nAssociations / m_buckets->size();
+    return double(m_nAssociations) / m_buckets.size();
+}
+
+template<typename KeyType, typename ValueType>
+unsigned int ExpandableHashMap<KeyType, ValueType>::hashOf(const KeyType& key) const {
+    // find number of well distribution using hash function
+    unsigned int hasher(const KeyType& k);
+    unsigned int h = hasher(key);
+
+    // mix the bits so the low bits used to pick a bucket depend on the whole hash
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
 }
 
 
 // function that prints out current ExpandableHashMap.h (meant for analysis)
 template<typename KeyType, typename ValueType>
 void ExpandableHashMap<KeyType, ValueType>::print() const {
-    
-    for (int i = 0; i < m_buckets->size(); i++) {
+
+    for (int i = 0; i < m_buckets.size(); i++) {
         cout << "bucket " << i << endl;
-        for (typename list<KeyAndValue>::iterator p = (*m_buckets)[i]->begin(); p != (*m_buckets)[i]->end(); p++) {
-            
-            KeyType key = (*p).m_KeyType;
-            ValueType values = (*p).m_ValueType;
+        if (m_distances[i] != 0) {
+
+            KeyType key = m_buckets[i].m_KeyType;
+            ValueType values = m_buckets[i].m_ValueType;
             cout << '\t';
             cout << key;
             cout << "  -->  ";
             cout << values;
         }
         cout << endl;
-        
-    } 
-    
+
+    }
+
+    // buckets not yet moved from before the last growth
+    for (int i = m_nextToMove; i < m_oldBuckets.size(); i++) {
+        if (m_oldDistances[i] != 0) {
+            cout << "old bucket " << i << endl;
+            cout << '\t';
+            cout << m_oldBuckets[i].m_KeyType;
+            cout << "  -->  ";
+            cout << m_oldBuckets[i].m_ValueType;
+            cout << endl;
+        }
+    }
+
 }
 
 
-//#endif
+#endif
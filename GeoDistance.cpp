@@ -0,0 +1,76 @@
+#include "GeoDistance.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+#ifdef __AVX2__
+// load base[index[0]] .. base[index[3]]; the masked form of the gather is used because it
+// says what fills the register before loading, where the plain one leaves it undefined
+static inline __m256d gather(const double* base, __m128i index)
+{
+    __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, index, all, 8);
+}
+#endif
+
+void CoordTable::clear()
+{
+    m_sinHalfLatitudes.clear();
+    m_cosHalfLatitudes.clear();
+    m_sinHalfLongitudes.clear();
+    m_cosHalfLongitudes.clear();
+    m_cosLatitudes.clear();
+}
+
+void CoordTable::build(const vector<double>& latitudes, const vector<double>& longitudes)
+{
+    const double pi = 3.14159265358979323846;
+    clear();
+    for (int i = 0; i < latitudes.size(); i++) {
+        double latr = latitudes[i] * pi / 180;
+        double lonr = longitudes[i] * pi / 180;
+        m_sinHalfLatitudes.push_back(sin(latr / 2));
+        m_cosHalfLatitudes.push_back(cos(latr / 2));
+        m_sinHalfLongitudes.push_back(sin(lonr / 2));
+        m_cosHalfLongitudes.push_back(cos(lonr / 2));
+        m_cosLatitudes.push_back(cos(latr));
+    }
+}
+
+void CoordTable::milesFrom(int from, const int* to, int n, double* out) const
+{
+    int i = 0;
+#ifdef __AVX2__
+    // four at a time: the haversine and its square root in vector registers, then the
+    // arcsine lane by lane, as there is no vector arcsine to call
+    __m256d sinLatA = _mm256_set1_pd(m_sinHalfLatitudes[from]);
+    __m256d cosLatA = _mm256_set1_pd(m_cosHalfLatitudes[from]);
+    __m256d sinLonA = _mm256_set1_pd(m_sinHalfLongitudes[from]);
+    __m256d cosLonA = _mm256_set1_pd(m_cosHalfLongitudes[from]);
+    __m256d cosA = _mm256_set1_pd(m_cosLatitudes[from]);
+    __m256d one = _mm256_set1_pd(1.0);
+    for (; i + 4 <= n; i += 4) {
+        __m128i b = _mm_loadu_si128((const __m128i*)(to + i));
+        __m256d sinLatB = gather(m_sinHalfLatitudes.data(), b);
+        __m256d cosLatB = gather(m_cosHalfLatitudes.data(), b);
+        __m256d sinLonB = gather(m_sinHalfLongitudes.data(), b);
+        __m256d cosLonB = gather(m_cosHalfLongitudes.data(), b);
+        __m256d cosB = gather(m_cosLatitudes.data(), b);
+        __m256d u = _mm256_sub_pd(_mm256_mul_pd(sinLatB, cosLatA), _mm256_mul_pd(cosLatB, sinLatA));
+        __m256d v = _mm256_sub_pd(_mm256_mul_pd(sinLonB, cosLonA), _mm256_mul_pd(cosLonB, sinLonA));
+        __m256d h = _mm256_add_pd(_mm256_mul_pd(u, u), _mm256_mul_pd(_mm256_mul_pd(cosA, cosB), _mm256_mul_pd(v, v)));
+        __m256d root = _mm256_sqrt_pd(_mm256_min_pd(h, one));
+        double roots[4];
+        _mm256_storeu_pd(roots, root);
+        for (int k = 0; k < 4; k++)
+            out[i + k] = 2.0 * EARTH_RADIUS_MILES * asin(roots[k]);
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = miles(from, to[i]);
+}
@@ -0,0 +1,88 @@
+// GeoDistance.h
+
+#ifndef GEODISTANCE_INCLUDED
+#define GEODISTANCE_INCLUDED
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+const double EARTH_RADIUS_MILES = 6371.0 / 1.609344;
+
+// point on the unit sphere for a latitude and longitude in degrees, as x, y, z
+inline void toUnitVector(double latitude, double longitude, double* xyz)
+{
+    const double pi = 3.14159265358979323846;
+    double latr = latitude * pi / 180;
+    double lonr = longitude * pi / 180;
+    xyz[0] = cos(latr) * cos(lonr);
+    xyz[1] = cos(latr) * sin(lonr);
+    xyz[2] = sin(latr);
+}
+
+// straight-line distance in miles through the earth between two unit vectors. It is never
+// more than the great-circle distance and grows whenever that does, differing from it by
+// less than a millionth over a hundred miles, and needs no trigonometry, so it is the
+// estimate to use where a lower bound is wanted many times over (as in A*).
+inline double chordMiles(const double* a, const double* b)
+{
+    double dx = a[0] - b[0];
+    double dy = a[1] - b[1];
+    double dz = a[2] - b[2];
+    return EARTH_RADIUS_MILES * sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// Coordinates of a set of places, with the trigonometry distanceEarthMiles would do for
+// them worked out once, so a distance between two of them costs one arcsine.
+//
+// The values are kept as separate arrays (sines and cosines of half the latitude and
+// longitude, and cosine of the latitude), so milesFrom can work out four distances from one
+// place at once with AVX2. That is opt-in: the build must ask for AVX2 (-mavx2 or
+// /arch:AVX2), and the program then runs only on processors that have it. Otherwise
+// milesFrom works them out one at a time. Either way it agrees with miles up to rounding.
+class CoordTable
+{
+public:
+    void clear();
+    void build(const vector<double>& latitudes, const vector<double>& longitudes);
+    int size() const;
+
+    // great-circle distance in miles between places a and b, by distanceEarthMiles' formula
+    double miles(int a, int b) const;
+
+    // distances from place "from" to each of the n places in to, into out
+    void milesFrom(int from, const int* to, int n, double* out) const;
+
+private:
+    vector<double> m_sinHalfLatitudes;
+    vector<double> m_cosHalfLatitudes;
+    vector<double> m_sinHalfLongitudes;
+    vector<double> m_cosHalfLongitudes;
+    vector<double> m_cosLatitudes;
+
+    // Helper Function
+    double haversine(int a, int b) const;
+};
+
+inline int CoordTable::size() const
+{
+    return m_cosLatitudes.size();
+}
+
+// sin and cos of half the difference come from those of the halves:
+// sin((b - a) / 2) = sin(b / 2) cos(a / 2) - cos(b / 2) sin(a / 2)
+inline double CoordTable::haversine(int a, int b) const
+{
+    double u = m_sinHalfLatitudes[b] * m_cosHalfLatitudes[a] - m_cosHalfLatitudes[b] * m_sinHalfLatitudes[a];
+    double v = m_sinHalfLongitudes[b] * m_cosHalfLongitudes[a] - m_cosHalfLongitudes[b] * m_sinHalfLongitudes[a];
+    return u * u + m_cosLatitudes[a] * m_cosLatitudes[b] * v * v;
+}
+
+inline double CoordTable::miles(int a, int b) const
+{
+    return 2.0 * EARTH_RADIUS_MILES * asin(sqrt(min(haversine(a, b), 1.0)));
+}
+
+#endif
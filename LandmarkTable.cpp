@@ -0,0 +1,175 @@
+#include "LandmarkTable.h"
+#include "RouteEngine.h"
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+// fill distance with the road distance from source to every node (infinity where unreachable)
+static void distancesFrom(const StreetGraph& graph, int source, vector<double>& distance, IndexedMinHeap& open)
+{
+    fill(distance.begin(), distance.end(), numeric_limits<double>::infinity());
+    open.clear();
+    distance[source] = 0;
+    open.push(source, 0);
+    while (!open.empty()) {
+        int current = open.popMin();
+        for (int e : graph.getEdges(current)) {
+            int next = graph.getEdgeTarget(e);
+            double newDistance = distance[current] + graph.getEdgeLength(e);
+            if (newDistance >= distance[next])
+                continue;
+            bool reached = distance[next] != numeric_limits<double>::infinity();
+            distance[next] = newDistance;
+            if (reached && open.contains(next))
+                open.decreaseKey(next, newDistance);
+            else
+                open.push(next, newDistance);
+        }
+    }
+}
+
+// return a node of the largest connected part of the graph
+static int nodeOfLargestPart(const StreetGraph& graph)
+{
+    // label each part by walking out from every node not yet labelled
+    int nNodes = graph.getNodeCount();
+    vector<int> part(nNodes, -1);
+    vector<int> stack;
+    int bestNode = 0;
+    int bestSize = 0;
+    for (int n = 0; n < nNodes; n++) {
+        if (part[n] != -1)
+            continue;
+        int size = 0;
+        part[n] = n;
+        stack.push_back(n);
+        while (!stack.empty()) {
+            int current = stack.back();
+            stack.pop_back();
+            size++;
+            for (int e : graph.getEdges(current)) {
+                int next = graph.getEdgeTarget(e);
+                if (part[next] == -1) {
+                    part[next] = n;
+                    stack.push_back(next);
+                }
+            }
+        }
+        if (size > bestSize) {
+            bestSize = size;
+            bestNode = n;
+        }
+    }
+    return bestNode;
+}
+
+LandmarkTable::LandmarkTable()
+{
+    clear();
+}
+
+void LandmarkTable::clear()
+{
+    m_landmarks.clear();
+    m_distances.clear();
+}
+
+void LandmarkTable::build(const StreetGraph& graph, int nLandmarks)
+{
+    clear();
+    int nNodes = graph.getNodeCount();
+    if (nNodes == 0 || nLandmarks <= 0)
+        return;
+
+    // the first landmark is the node farthest from somewhere in the largest part of the map,
+    // and each later one the node farthest from every landmark picked so far
+    vector<double> distance(nNodes);
+    vector<double> nearest(nNodes, numeric_limits<double>::infinity());
+    vector<vector<double>> columns;
+    vector<int> landmarks;
+    IndexedMinHeap open;
+    distancesFrom(graph, nodeOfLargestPart(graph), distance, open);
+    for (int k = 0; k < nLandmarks; k++) {
+        // the farthest reachable node from what has been looked at so far
+        const vector<double>& from = k == 0 ? distance : nearest;
+        int farthest = -1;
+        for (int n = 0; n < nNodes; n++) {
+            if (distance[n] != numeric_limits<double>::infinity() && (farthest == -1 || from[n] > from[farthest]))
+                farthest = n;
+        }
+        // stop early on a map with fewer places than landmarks
+        if (k > 0 && nearest[farthest] == 0)
+            break;
+
+        landmarks.push_back(farthest);
+        columns.push_back(vector<double>(nNodes));
+        distancesFrom(graph, farthest, columns.back(), open);
+        for (int n = 0; n < nNodes; n++)
+            nearest[n] = min(nearest[n], columns.back()[n]);
+    }
+
+    // lay the distances out node by node
+    int nChosen = landmarks.size();
+    vector<float> distances((long long)nNodes * nChosen);
+    for (int n = 0; n < nNodes; n++) {
+        for (int k = 0; k < nChosen; k++)
+            distances[(long long)n * nChosen + k] = columns[k][n];
+    }
+    m_landmarks.adopt(landmarks);
+    m_distances.adopt(distances);
+}
+
+bool LandmarkTable::isBuilt() const
+{
+    return !m_landmarks.empty();
+}
+
+void LandmarkTable::addSnapshotSections(SnapshotWriter& writer) const
+{
+    writer.addSection(SECTION_LANDMARK_NODES, m_landmarks.data(), m_landmarks.size() * sizeof(int));
+    writer.addSection(SECTION_LANDMARK_DISTANCES, m_distances.data(), (long long)m_distances.size() * sizeof(float));
+}
+
+bool LandmarkTable::attach(const MappedSnapshot& snapshot, int nNodes)
+{
+    // a snapshot saved without landmarks simply has none of these sections
+    clear();
+    bool ok = snapshot.attach(SECTION_LANDMARK_NODES, m_landmarks);
+
+    // a damaged file can claim any number of landmarks, so the size of the table is worked
+    // out in long long and must still fit the int an array is indexed by
+    long long nDistances = (long long)nNodes * m_landmarks.size();
+    ok = ok && !m_landmarks.empty() && m_landmarks.size() <= nNodes
+            && nDistances <= numeric_limits<int>::max()
+            && snapshot.attach(SECTION_LANDMARK_DISTANCES, m_distances, nDistances);
+    if (!ok) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+int LandmarkTable::selectActive(int start, int end, int* active, int maxActive) const
+{
+    // rank the landmarks by the bound each gives between start and end, keeping the best
+    int nActive = 0;
+    for (int k = 0; k < m_landmarks.size(); k++) {
+        int one = k;
+        double bound = lowerBound(start, end, &one, 1);
+        if (bound <= 0)
+            continue;
+
+        // insert it in order, dropping the weakest if the list is full
+        int i = nActive < maxActive ? nActive++ : maxActive;
+        while (i > 0 && lowerBound(start, end, &active[i - 1], 1) < bound) {
+            if (i < maxActive)
+                active[i] = active[i - 1];
+            i--;
+        }
+        if (i < maxActive)
+            active[i] = k;
+    }
+    return nActive;
+}
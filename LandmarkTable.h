@@ -0,0 +1,100 @@
+// LandmarkTable.h
+
+#ifndef LANDMARKTABLE_INCLUDED
+#define LANDMARKTABLE_INCLUDED
+
+#include <vector>
+#include <limits>
+#include <cfloat>
+#include "StreetGraph.h"
+#include "Snapshot.h"
+
+using namespace std;
+
+// Road distances from a few landmark nodes to every node of a StreetGraph, for the
+// lower bounds of A* with landmarks (ALT).
+//
+// For any landmark L, the triangle inequality gives d(v, t) >= |d(L, t) - d(L, v)|, and
+// the best of these bounds over the landmarks is usually far closer to the real road
+// distance than the straight line is, especially where rivers or highways make roads
+// wind. Every segment can be travelled both ways, so one distance per node and landmark
+// serves as the distance both to and from it.
+//
+// Landmarks are picked one at a time as the node farthest from those already picked,
+// within the largest connected part of the map, which spreads them around its edge.
+// Distances are stored as floats, node by node, so the bounds of one node are next to
+// each other in memory.
+class LandmarkTable
+{
+public:
+    LandmarkTable();
+    void clear();
+    void build(const StreetGraph& graph, int nLandmarks);
+    bool isBuilt() const;
+
+    // snapshots
+    void addSnapshotSections(SnapshotWriter& writer) const;
+    bool attach(const MappedSnapshot& snapshot, int nNodes);
+
+    int getLandmarkCount() const;
+    int getLandmark(int i) const;
+    float getDistance(int node, int landmark) const;
+
+    // choose up to maxActive landmarks that give the best bound from start to end, store
+    // them in active and return how many were stored; a query only uses those
+    int selectActive(int start, int end, int* active, int maxActive) const;
+
+    // lower bound on the road distance from node to end using the given landmarks
+    double lowerBound(int node, int end, const int* active, int nActive) const;
+
+    LandmarkTable(const LandmarkTable&) = delete;
+    LandmarkTable& operator=(const LandmarkTable&) = delete;
+
+private:
+    MappedArray<int> m_landmarks;
+    MappedArray<float> m_distances;     // landmark count entries per node; infinity if unreachable
+};
+
+inline int LandmarkTable::getLandmarkCount() const
+{
+    return m_landmarks.size();
+}
+
+inline int LandmarkTable::getLandmark(int i) const
+{
+    return m_landmarks[i];
+}
+
+inline float LandmarkTable::getDistance(int node, int landmark) const
+{
+    return m_distances.data()[(long long)node * m_landmarks.size() + landmark];
+}
+
+// called for every node the search reaches, so it is defined here where it can be inlined
+inline double LandmarkTable::lowerBound(int node, int end, const int* active, int nActive) const
+{
+    const float* atNode = m_distances.data() + (long long)node * m_landmarks.size();
+    const float* atEnd = m_distances.data() + (long long)end * m_landmarks.size();
+    double best = 0;
+    for (int i = 0; i < nActive; i++) {
+        // equal distances bound nothing (this also skips a landmark that reaches neither
+        // node); if it reaches only one of them, the bound is infinite, as is the distance
+        float a = atNode[active[i]];
+        float b = atEnd[active[i]];
+        if (a == b)
+            continue;
+        double far = a > b ? a : b;
+        double near = a > b ? b : a;
+        if (far == numeric_limits<float>::infinity())
+            return far;
+
+        // each distance was rounded to a float when stored, off by up to half an ulp, so take
+        // that much off the bound to keep it at or below the true distance
+        double bound = far - near - 2 * FLT_EPSILON * far;
+        if (bound > best)
+            best = bound;
+    }
+    return best;
+}
+
+#endif
@@ -0,0 +1,203 @@
+#include "PointGrid.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+const double MILES_PER_DEGREE_LATITUDE = 6371.0 / 1.609344 * 3.14159265358979323846 / 180;
+const double POINTS_PER_CELL = 2;
+
+PointGrid::PointGrid()
+{
+    clear();
+}
+
+void PointGrid::clear()
+{
+    m_originLatitude = 0;
+    m_originLongitude = 0;
+    m_milesPerDegreeLongitude = MILES_PER_DEGREE_LATITUDE;
+    m_minX = 0;
+    m_minY = 0;
+    m_cellSize = 1;
+    m_nColumns = 0;
+    m_nRows = 0;
+    m_cellStarts.clear();
+    m_cellEnds.clear();
+    m_cellPoints.clear();
+    m_slots.clear();
+    m_cells.clear();
+    m_x.clear();
+    m_y.clear();
+}
+
+void PointGrid::build(const vector<double>& latitudes, const vector<double>& longitudes)
+{
+    clear();
+    int nPoints = latitudes.size();
+    if (nPoints == 0)
+        return;
+
+    // project around the middle of the points' bounding box
+    double minLatitude = *min_element(latitudes.begin(), latitudes.end());
+    double maxLatitude = *max_element(latitudes.begin(), latitudes.end());
+    double minLongitude = *min_element(longitudes.begin(), longitudes.end());
+    double maxLongitude = *max_element(longitudes.begin(), longitudes.end());
+    m_originLatitude = (minLatitude + maxLatitude) / 2;
+    m_originLongitude = (minLongitude + maxLongitude) / 2;
+    m_milesPerDegreeLongitude = MILES_PER_DEGREE_LATITUDE * cos(m_originLatitude * 3.14159265358979323846 / 180);
+    m_x.resize(nPoints);
+    m_y.resize(nPoints);
+    for (int i = 0; i < nPoints; i++) {
+        m_x[i] = toX(longitudes[i]);
+        m_y[i] = toY(latitudes[i]);
+    }
+
+    // size the cells so each holds about POINTS_PER_CELL points; points along a line have
+    // no area, so then go by the length of the line instead
+    m_minX = toX(minLongitude);
+    m_minY = toY(minLatitude);
+    double width = toX(maxLongitude) - m_minX;
+    double height = toY(maxLatitude) - m_minY;
+    double nCells = nPoints / POINTS_PER_CELL;
+    m_cellSize = max(sqrt(width * height / nCells), max(width, height) / nCells);
+    if (m_cellSize <= 0)
+        m_cellSize = 1;
+    m_nColumns = (int)(width / m_cellSize) + 1;
+    m_nRows = (int)(height / m_cellSize) + 1;
+
+    // count the points of each cell, then lay them out cell by cell
+    int nGridCells = m_nColumns * m_nRows;
+    m_cells.resize(nPoints);
+    m_cellStarts.assign(nGridCells + 1, 0);
+    for (int i = 0; i < nPoints; i++) {
+        m_cells[i] = rowOf(m_y[i]) * m_nColumns + columnOf(m_x[i]);
+        m_cellStarts[m_cells[i] + 1]++;
+    }
+    for (int c = 0; c < nGridCells; c++)
+        m_cellStarts[c + 1] += m_cellStarts[c];
+    m_cellEnds.assign(m_cellStarts.begin(), m_cellStarts.end() - 1);
+    m_cellPoints.resize(nPoints);
+    m_slots.resize(nPoints);
+    for (int i = 0; i < nPoints; i++) {
+        m_slots[i] = m_cellEnds[m_cells[i]]++;
+        m_cellPoints[m_slots[i]] = i;
+    }
+}
+
+void PointGrid::remove(int point)
+{
+    // swap the point with the last one its cell still has, then shorten the cell
+    int cell = m_cells[point];
+    int slot = m_slots[point];
+    if (slot >= m_cellEnds[cell])
+        return;
+    int last = m_cellEnds[cell] - 1;
+    int other = m_cellPoints[last];
+    m_cellPoints[slot] = other;
+    m_slots[other] = slot;
+    m_cellPoints[last] = point;
+    m_slots[point] = last;
+    m_cellEnds[cell]--;
+}
+
+int PointGrid::findNearest(double latitude, double longitude) const
+{
+    // ties go to the lower numbered point, so the answer does not depend on cell order
+    int best = -1;
+    double bestDistance = numeric_limits<double>::infinity();
+    searchRings(toX(longitude), toY(latitude), [&](int point, double distanceSquared) {
+        if (distanceSquared < bestDistance || (distanceSquared == bestDistance && point < best)) {
+            bestDistance = distanceSquared;
+            best = point;
+        }
+        return bestDistance;
+    });
+    return best;
+}
+
+void PointGrid::findNearest(double latitude, double longitude, int k, vector<int>& result, int exclude) const
+{
+    // keep the k best seen so far in order, ties going to the lower numbered point
+    vector<pair<double, int>> best;
+    result.clear();
+    if (k <= 0)
+        return;
+    searchRings(toX(longitude), toY(latitude), [&](int point, double distanceSquared) {
+        if (point != exclude) {
+            pair<double, int> entry(distanceSquared, point);
+            if (best.size() < k || entry < best.back()) {
+                if (best.size() == k)
+                    best.pop_back();
+                best.insert(upper_bound(best.begin(), best.end(), entry), entry);
+            }
+        }
+        return best.size() < k ? numeric_limits<double>::infinity() : best.back().first;
+    });
+    for (int i = 0; i < best.size(); i++)
+        result.push_back(best[i].second);
+}
+
+double PointGrid::toX(double longitude) const
+{
+    return (longitude - m_originLongitude) * m_milesPerDegreeLongitude;
+}
+
+double PointGrid::toY(double latitude) const
+{
+    return (latitude - m_originLatitude) * MILES_PER_DEGREE_LATITUDE;
+}
+
+int PointGrid::columnOf(double x) const
+{
+    int column = (int)floor((x - m_minX) / m_cellSize);
+    return min(max(column, 0), m_nColumns - 1);
+}
+
+int PointGrid::rowOf(double y) const
+{
+    int row = (int)floor((y - m_minY) / m_cellSize);
+    return min(max(row, 0), m_nRows - 1);
+}
+
+// call visit(point, squared distance) for the points left in rings of cells around (x, y),
+// nearest ring first; visit returns the squared distance beyond which nothing more is
+// wanted, and the search stops once every cell left is at least that far away
+template<typename Visit>
+void PointGrid::searchRings(double x, double y, const Visit& visit) const
+{
+    if (m_nColumns == 0)
+        return;
+    int column = columnOf(x);
+    int row = rowOf(y);
+    double wanted = numeric_limits<double>::infinity();
+    int maxRing = max(m_nColumns, m_nRows);
+    for (int ring = 0; ring <= maxRing; ring++) {
+        // every point in this ring (and beyond) is at least ring - 1 cells away, even from
+        // a place off the edge of the grid
+        double nearestInRing = max(ring - 1, 0) * m_cellSize;
+        if (nearestInRing * nearestInRing > wanted)
+            break;
+
+        int firstRow = max(row - ring, 0);
+        int lastRow = min(row + ring, m_nRows - 1);
+        for (int r = firstRow; r <= lastRow; r++) {
+            // rows at the top and bottom of the ring are whole, the others only have their two ends
+            bool wholeRow = r == row - ring || r == row + ring;
+            int step = wholeRow ? 1 : 2 * ring;
+            for (int c = column - ring; c <= column + ring; c += max(step, 1)) {
+                if (c < 0 || c >= m_nColumns)
+                    continue;
+                int cell = r * m_nColumns + c;
+                for (int slot = m_cellStarts[cell]; slot < m_cellEnds[cell]; slot++) {
+                    int point = m_cellPoints[slot];
+                    double dx = m_x[point] - x;
+                    double dy = m_y[point] - y;
+                    wanted = visit(point, dx * dx + dy * dy);
+                }
+            }
+        }
+    }
+}
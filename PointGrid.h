@@ -0,0 +1,66 @@
+// PointGrid.h
+
+#ifndef POINTGRID_INCLUDED
+#define POINTGRID_INCLUDED
+
+#include <vector>
+
+using namespace std;
+
+// Uniform grid over a set of points on the earth, for finding the points closest to a place.
+//
+// Points are projected onto a flat plane, in miles around the middle of their bounding
+// box, which is accurate to a fraction of a percent over an area the size of a city. The
+// plane is cut into square cells that hold a couple of points each on average. A query
+// searches rings of cells outward from the place and stops once no cell left could hold
+// anything closer than what it has found, so it looks at a handful of cells however many
+// points there are. Points can be removed, which lets the grid answer "closest one left"
+// while a tour is being built.
+class PointGrid
+{
+public:
+    PointGrid();
+    void clear();
+    void build(const vector<double>& latitudes, const vector<double>& longitudes);
+
+    // take a point out of the grid, so no query finds it again
+    void remove(int point);
+
+    // the point closest to the given place, or -1 if there are none left
+    int findNearest(double latitude, double longitude) const;
+
+    // fill result with the (up to) k points closest to the given place, closest first,
+    // leaving out point exclude
+    void findNearest(double latitude, double longitude, int k, vector<int>& result, int exclude = -1) const;
+
+private:
+    // projection onto the plane
+    double m_originLatitude;
+    double m_originLongitude;
+    double m_milesPerDegreeLongitude;
+
+    // cells, with the points of each in compressed sparse row form; the points a cell still
+    // has come first, m_cellEnds marking where they stop
+    double m_minX;
+    double m_minY;
+    double m_cellSize;
+    int m_nColumns;
+    int m_nRows;
+    vector<int> m_cellStarts;
+    vector<int> m_cellEnds;
+    vector<int> m_cellPoints;
+    vector<int> m_slots;        // where each point sits in m_cellPoints
+    vector<int> m_cells;        // cell each point is in
+    vector<double> m_x;
+    vector<double> m_y;
+
+    // Helper Functions
+    double toX(double longitude) const;
+    double toY(double latitude) const;
+    int columnOf(double x) const;
+    int rowOf(double y) const;
+    template<typename Visit>
+    void searchRings(double x, double y, const Visit& visit) const;
+};
+
+#endif
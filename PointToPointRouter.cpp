@@ -2,8 +2,10 @@
 #include <list>
 using namespace std;
 
-#include "ExpandableHashMap.h"
-#include <queue>
+#include <vector>
+#include "StreetGraph.h"
+#include "RouteEngine.h"
+#include "RouteCache.h"
 
 
 class PointToPointRouterImpl
@@ -15,13 +17,57 @@ public:
         const GeoCoord& start,
         const GeoCoord& end,
         list<StreetSegment>& route,
+        double& totalDistanceTravelled,
+        RouteSearchMode mode) const;
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        CompactRoute& route,
+        RouteSearchMode mode) const;
+    DeliveryResult computeDistanceMatrix(
+        const vector<GeoCoord>& locations,
+        vector<double>& distances) const;
+    DeliveryResult buildShortestPathTree(
+        const GeoCoord& source,
+        const vector<GeoCoord>& targets,
+        ShortestPathTree& tree) const;
+    DeliveryResult generateRouteFromSource(
+        const ShortestPathTree& tree,
+        int target,
+        list<StreetSegment>& route,
         double& totalDistanceTravelled) const;
+    DeliveryResult generateRouteFromSource(
+        const ShortestPathTree& tree,
+        int target,
+        CompactRoute& route) const;
+    DeliveryResult generateRouteToSource(
+        const ShortestPathTree& tree,
+        int target,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const;
+    DeliveryResult generateRouteToSource(
+        const ShortestPathTree& tree,
+        int target,
+        CompactRoute& route) const;
+    void setSnapDistance(double miles);
+    void setRouteCaching(bool enabled);
 private:
     const StreetMap* m_StreetMap;
+    double m_snapDistance;  // places off the map are moved to a node this close, if any
+    bool m_routeCaching;    // look routes up in (and add them to) the map's route cache
+    
+    // search state kept between queries (so one router must not be shared across threads),
+    // and the route being turned into segments for the functions that return those
+    RouteEngine m_engine;
+    mutable CompactRoute m_route;
+    
+    // Helper Functions
+    int findNode(const GeoCoord& gc) const;
+    DeliveryResult toSegments(DeliveryResult result, list<StreetSegment>& route, double& totalDistanceTravelled) const;
 };
 
 PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
-:   m_StreetMap(sm)
+:   m_StreetMap(sm), m_snapDistance(0), m_routeCaching(false), m_engine(sm)
 {
 }
 
@@ -33,110 +79,177 @@ DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
         const GeoCoord& start,
         const GeoCoord& end,
         list<StreetSegment>& route,
-        double& totalDistanceTravelled) const
+        double& totalDistanceTravelled,
+        RouteSearchMode mode) const
+{
+    return toSegments(generatePointToPointRoute(start, end, m_route, mode), route, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        CompactRoute& route,
+        RouteSearchMode mode) const
 {
     // clear the given variables of any past values
-    route.clear();
-    totalDistanceTravelled = 0;
+    route.start = -1;
+    route.edges.clear();
+    route.distance = 0;
     
     // if start equals end, the delivery is done (no route needed)
     if (start == end) {
         return DELIVERY_SUCCESS;
     }
 
-    vector<StreetSegment> segsToCheckBadCoord;
-    
     // check to see if start and end coordinates are valid
-    if(!m_StreetMap->getSegmentsThatStartWith(end, segsToCheckBadCoord))
+    int startId = findNode(start);
+    int endId = findNode(end);
+    if (startId == -1 || endId == -1)
         return BAD_COORD;
-    if(!m_StreetMap->getSegmentsThatStartWith(start, segsToCheckBadCoord))
-        return BAD_COORD;
-    
-    GeoCoord current = start;
+    route.start = startId;
     
-    // create a queue for our search of valid routes
-    queue<GeoCoord> coords;
-    coords.push(current);
-    vector<GeoCoord> visited;
+    // a route found before on this map is taken as it is; otherwise search for one, and if
+    // the end was never reached, there is no route. The cache is keyed only on the ends, so
+    // a search other than the default one, which may break ties between equally short
+    // routes differently, neither uses nor fills it
+    RouteCache* cache = m_routeCaching && mode == SEARCH_ASTAR ? m_StreetMap->getRouteCache() : nullptr;
+    shared_ptr<const CompactRoute> cached = cache != nullptr ? cache->find(startId, endId) : nullptr;
+    if (cached != nullptr) {
+        route.edges = cached->edges;
+        route.distance = cached->distance;
+    }
+    else {
+        if (!m_engine.findRoute(startId, endId, mode, route.edges, route.distance))
+            return NO_ROUTE;
+        if (cache != nullptr)
+            cache->insert(startId, endId, route);
+    }
     
-    // create map to record the route we choose to travel and later set
-    ExpandableHashMap<GeoCoord, GeoCoord> locationOfPreviousWayPoint;
+    // delivery was successful
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult PointToPointRouterImpl::computeDistanceMatrix(
+        const vector<GeoCoord>& locations,
+        vector<double>& distances) const
+{
+    distances.clear();
     
-    // loop through the available paths in a circular manner (dictated by the use of a queue)
-    bool pathFound = false;
-    while (!coords.empty()) {
-        // access the current coordinate off the queue
-        current = coords.front();
-        coords.pop();
-        // if the current coordinate being checked is the end, the route is finished
-        if (current == end) {
-            pathFound = true;
-            break;
-        }
-        vector<StreetSegment> segs;
-        m_StreetMap->getSegmentsThatStartWith(current, segs);
-        visited.push_back(current);
-        // loop through potential paths off of the current coordinate
-        for (int i = 0; i < segs.size(); i++) {
-            // make sure the potential paths does not lead to a coordinate already visited
-            bool notVisited = true;
-            for (int j = 0; j < visited.size() && notVisited == true; j++) {
-                if (segs[i].end == visited[j]) {
-                    notVisited = false;
-                }
-            }
-            if (notVisited) {
-                coords.push(segs[i].end);
-                locationOfPreviousWayPoint.associate(segs[i].end, current);
-            }
-        }
+    // every location must be on the map (or close enough to snap to it)
+    vector<int> nodes;
+    for (const GeoCoord& gc : locations) {
+        int node = findNode(gc);
+        if (node == -1)
+            return BAD_COORD;
+        nodes.push_back(node);
     }
     
-    // if a valid path was found, construct the route
-    if (pathFound) {
-        list<StreetSegment> optimalRoute;
-        
-        // obtain end point and previous point
-        GeoCoord endUse = end;
-        current = endUse;
-        GeoCoord prev = endUse;
-        // loop until we reach the starting location
-        while (prev != start) {
-            GeoCoord* prevPointer = locationOfPreviousWayPoint.find(endUse);
-            prev = *prevPointer;
-            
-            // construct street segment the two points make up and add it to the route
-            string streetName;
-            vector<StreetSegment> segs;
-            m_StreetMap->getSegmentsThatStartWith(prev, segs);
-            for (int i = 0; i < segs.size(); i++) {
-                if (segs[i].end == endUse) {
-                    streetName = segs[i].name;
-                    break;
-                }
-            }
-            // add found segment to the route
-            optimalRoute.push_back(StreetSegment(prev, endUse, streetName));
-            
-            endUse = prev;
-        }
-        
-        // flip route, since it was built back to front
-        optimalRoute.reverse();
-        
-        // if route is empty, no route was found
-        if (optimalRoute.empty())
-            return NO_ROUTE;
-        
-        // set route to the route we found
-        route = optimalRoute;
-        
-        // delivery was successful
-        return DELIVERY_SUCCESS;
+    // compute all the distances at once, straight into the caller's matrix
+    RouteEngine::computeDistanceMatrix(m_StreetMap, nodes, distances);
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult PointToPointRouterImpl::buildShortestPathTree(
+        const GeoCoord& source,
+        const vector<GeoCoord>& targets,
+        ShortestPathTree& tree) const
+{
+    tree.clear();
+    
+    // the source and every target must be on the map (or close enough to snap to it)
+    int sourceId = findNode(source);
+    if (sourceId == -1)
+        return BAD_COORD;
+    vector<int> targetIds;
+    for (const GeoCoord& gc : targets) {
+        int node = findNode(gc);
+        if (node == -1)
+            return BAD_COORD;
+        targetIds.push_back(node);
     }
     
-    return NO_ROUTE;
+    // one search reaches every target; routes are read off the tree as they are asked for
+    m_engine.findTree(sourceId, targetIds, tree);
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult PointToPointRouterImpl::generateRouteFromSource(
+        const ShortestPathTree& tree,
+        int target,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const
+{
+    return toSegments(generateRouteFromSource(tree, target, m_route), route, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouterImpl::generateRouteFromSource(
+        const ShortestPathTree& tree,
+        int target,
+        CompactRoute& route) const
+{
+    route.start = tree.getSource();
+    route.distance = 0;
+    if (!tree.getEdgesFromSource(target, route.edges))
+        return NO_ROUTE;
+    route.distance = tree.getDistance(target);
+    return DELIVERY_SUCCESS;
+}
 
+DeliveryResult PointToPointRouterImpl::generateRouteToSource(
+        const ShortestPathTree& tree,
+        int target,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const
+{
+    return toSegments(generateRouteToSource(tree, target, m_route), route, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouterImpl::generateRouteToSource(
+        const ShortestPathTree& tree,
+        int target,
+        CompactRoute& route) const
+{
+    route.start = tree.getTarget(target);
+    route.distance = 0;
+    if (!tree.getEdgesToSource(*m_StreetMap->getGraph(), target, route.edges))
+        return NO_ROUTE;
+    route.distance = tree.getDistance(target);
+    return DELIVERY_SUCCESS;
+}
+
+void PointToPointRouterImpl::setSnapDistance(double miles)
+{
+    m_snapDistance = miles;
+}
+
+void PointToPointRouterImpl::setRouteCaching(bool enabled)
+{
+    m_routeCaching = enabled;
+}
+
+// return the node at gc, or the closest one within the snap distance; -1 if there is none
+int PointToPointRouterImpl::findNode(const GeoCoord& gc) const
+{
+    if (m_snapDistance > 0)
+        return m_StreetMap->findNearestNode(gc, m_snapDistance);
+    return m_StreetMap->getGraph()->findNode(gc);
+}
+
+// give m_route, as a search or tree has just filled it, out as segments; only done for
+// callers that want a list<StreetSegment>, as it copies every coordinate and street name
+// along the way
+DeliveryResult PointToPointRouterImpl::toSegments(
+        DeliveryResult result,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const
+{
+    route.clear();
+    totalDistanceTravelled = 0;
+    if (result != DELIVERY_SUCCESS)
+        return result;
+    m_StreetMap->getGraph()->getSegments(m_route, route);
+    totalDistanceTravelled = m_route.distance;
+    return DELIVERY_SUCCESS;
 }
 
 //******************** PointToPointRouter functions ***************************
@@ -160,5 +273,82 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const
 {
-    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled, SEARCH_ASTAR);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled,
+        RouteSearchMode mode) const
+{
+    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled, mode);
+}
+
+DeliveryResult PointToPointRouter::computeDistanceMatrix(
+        const vector<GeoCoord>& locations,
+        vector<double>& distances) const
+{
+    return m_impl->computeDistanceMatrix(locations, distances);
+}
+
+void PointToPointRouter::setSnapDistance(double miles)
+{
+    m_impl->setSnapDistance(miles);
+}
+
+void PointToPointRouter::setRouteCaching(bool enabled)
+{
+    m_impl->setRouteCaching(enabled);
+}
+
+DeliveryResult PointToPointRouter::buildShortestPathTree(
+        const GeoCoord& source,
+        const vector<GeoCoord>& targets,
+        ShortestPathTree& tree) const
+{
+    return m_impl->buildShortestPathTree(source, targets, tree);
+}
+
+DeliveryResult PointToPointRouter::generateRouteFromSource(
+        const ShortestPathTree& tree,
+        int target,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const
+{
+    return m_impl->generateRouteFromSource(tree, target, route, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouter::generateRouteToSource(
+        const ShortestPathTree& tree,
+        int target,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const
+{
+    return m_impl->generateRouteToSource(tree, target, route, totalDistanceTravelled);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        CompactRoute& route) const
+{
+    return m_impl->generatePointToPointRoute(start, end, route, SEARCH_ASTAR);
+}
+
+DeliveryResult PointToPointRouter::generateRouteFromSource(
+        const ShortestPathTree& tree,
+        int target,
+        CompactRoute& route) const
+{
+    return m_impl->generateRouteFromSource(tree, target, route);
+}
+
+DeliveryResult PointToPointRouter::generateRouteToSource(
+        const ShortestPathTree& tree,
+        int target,
+        CompactRoute& route) const
+{
+    return m_impl->generateRouteToSource(tree, target, route);
 }
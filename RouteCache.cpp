@@ -0,0 +1,123 @@
+#include "RouteCache.h"
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+// rough cost of keeping one route besides its edges: the route itself, its place in the
+// recency list and in the index
+const long long ENTRY_OVERHEAD_BYTES = sizeof(CompactRoute) + 96;
+
+static unsigned long long makeKey(int start, int end)
+{
+    return ((unsigned long long)(unsigned int)start << 32) | (unsigned int)end;
+}
+
+RouteCache::RouteCache(long long capacityBytes)
+:   m_capacity(capacityBytes)
+{
+    clear();
+}
+
+void RouteCache::clear()
+{
+    for (Shard& shard : m_shards) {
+        lock_guard<mutex> lock(shard.m_mutex);
+        shard.m_entries.clear();
+        shard.m_index.clear();
+        shard.m_bytes = 0;
+        shard.m_hits = 0;
+        shard.m_misses = 0;
+        shard.m_evictions = 0;
+    }
+}
+
+void RouteCache::setCapacity(long long capacityBytes)
+{
+    m_capacity = capacityBytes;
+    for (Shard& shard : m_shards) {
+        lock_guard<mutex> lock(shard.m_mutex);
+        evict(shard, capacityBytes / SHARD_COUNT);
+    }
+}
+
+long long RouteCache::getCapacity() const
+{
+    return m_capacity;
+}
+
+shared_ptr<const CompactRoute> RouteCache::find(int start, int end)
+{
+    unsigned long long key = makeKey(start, end);
+    Shard& shard = shardOf(key);
+    lock_guard<mutex> lock(shard.m_mutex);
+    auto p = shard.m_index.find(key);
+    if (p == shard.m_index.end()) {
+        shard.m_misses++;
+        return nullptr;
+    }
+
+    // a route that is asked for again moves to the front, farthest from being dropped
+    shard.m_hits++;
+    shard.m_entries.splice(shard.m_entries.begin(), shard.m_entries, p->second);
+    return p->second->m_route;
+}
+
+void RouteCache::insert(int start, int end, const CompactRoute& route)
+{
+    // copy the route before taking the lock, so threads only wait for the bookkeeping
+    long long bytes = ENTRY_OVERHEAD_BYTES + (long long)route.edges.size() * sizeof(int);
+    long long capacity = m_capacity / SHARD_COUNT;
+    if (bytes > capacity)
+        return;
+    shared_ptr<const CompactRoute> copy = make_shared<CompactRoute>(route);
+
+    unsigned long long key = makeKey(start, end);
+    Shard& shard = shardOf(key);
+    lock_guard<mutex> lock(shard.m_mutex);
+
+    // two threads may have found the same route at once; the first one stored is kept
+    if (shard.m_index.find(key) != shard.m_index.end())
+        return;
+    shard.m_entries.push_front(Entry{key, copy, bytes});
+    shard.m_index[key] = shard.m_entries.begin();
+    shard.m_bytes += bytes;
+    evict(shard, capacity);
+}
+
+RouteCacheStatistics RouteCache::getStatistics() const
+{
+    RouteCacheStatistics statistics = {0, 0, 0, 0, 0};
+    for (const Shard& shard : m_shards) {
+        lock_guard<mutex> lock(shard.m_mutex);
+        statistics.hits += shard.m_hits;
+        statistics.misses += shard.m_misses;
+        statistics.evictions += shard.m_evictions;
+        statistics.entries += shard.m_index.size();
+        statistics.bytes += shard.m_bytes;
+    }
+    return statistics;
+}
+
+RouteCache::Shard& RouteCache::shardOf(unsigned long long key)
+{
+    // mix the key so routes from one start node spread over every shard; the top four
+    // bits pick one of the SHARD_COUNT shards
+    key *= 0x9E3779B97F4A7C15ULL;
+    return m_shards[key >> 60];
+}
+
+// drop least recently used routes until the shard's routes fit in capacity (the shard's
+// lock must be held)
+void RouteCache::evict(Shard& shard, long long capacity)
+{
+    while (shard.m_bytes > capacity && !shard.m_entries.empty()) {
+        const Entry& last = shard.m_entries.back();
+        shard.m_bytes -= last.m_bytes;
+        shard.m_index.erase(last.m_key);
+        shard.m_entries.pop_back();
+        shard.m_evictions++;
+    }
+}
@@ -0,0 +1,79 @@
+// RouteCache.h
+
+#ifndef ROUTECACHE_INCLUDED
+#define ROUTECACHE_INCLUDED
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "StreetGraph.h"
+
+using namespace std;
+
+struct RouteCacheStatistics
+{
+    long long hits;
+    long long misses;
+    long long evictions;
+    long long entries;          // routes held now
+    long long bytes;            // memory they take, roughly
+};
+
+// Routes already found on a map, kept so a planner asking for the same leg again (the way
+// to and from a depot, a stop visited every day) gets it without a search.
+//
+// Routes are keyed on their start and end node and dropped least recently used first once
+// the memory they take passes the capacity. The cache is safe to use from many threads:
+// it is split into shards by key, each with its own lock, so threads routing different
+// legs seldom wait for each other, and a route handed out stays valid however long it is
+// used, even if the cache drops it in the meantime.
+class RouteCache
+{
+public:
+    RouteCache(long long capacityBytes = DEFAULT_CAPACITY_BYTES);
+    void clear();                               // drop every route and zero the counters
+    void setCapacity(long long capacityBytes);  // dropping routes if they no longer fit
+    long long getCapacity() const;
+
+    // the shortest route from node start to node end if it is cached, or nullptr
+    shared_ptr<const CompactRoute> find(int start, int end);
+
+    // remember route as the shortest route from node start to node end
+    void insert(int start, int end, const CompactRoute& route);
+
+    RouteCacheStatistics getStatistics() const;
+
+    RouteCache(const RouteCache&) = delete;
+    RouteCache& operator=(const RouteCache&) = delete;
+
+    static const long long DEFAULT_CAPACITY_BYTES = 64LL << 20;
+
+private:
+    struct Entry {
+        unsigned long long m_key;
+        shared_ptr<const CompactRoute> m_route;
+        long long m_bytes;
+    };
+    struct Shard {
+        mutable mutex m_mutex;
+        list<Entry> m_entries;      // most recently used first
+        unordered_map<unsigned long long, list<Entry>::iterator> m_index;
+        long long m_bytes;
+        long long m_hits;
+        long long m_misses;
+        long long m_evictions;
+    };
+    static const int SHARD_COUNT = 16;
+
+    Shard m_shards[SHARD_COUNT];
+    atomic<long long> m_capacity;   // split evenly among the shards
+
+    // Helper Functions
+    Shard& shardOf(unsigned long long key);
+    void evict(Shard& shard, long long capacity);
+};
+
+#endif
@@ -0,0 +1,738 @@
+#include "RouteEngine.h"
+#include "ContractionHierarchy.h"
+#include "LandmarkTable.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+// most landmarks a landmark search consults, picked per query as those giving the best
+// bound between its start and end
+const int ACTIVE_LANDMARKS = 4;
+
+//******************** IndexedMinHeap functions *******************************
+
+void IndexedMinHeap::clear()
+{
+    // only the handles still in the heap need their positions reset, so the
+    // storage is kept and reused by the next search
+    for (int i = 0; i < m_heap.size(); i++)
+        m_positions[m_heap[i]] = -1;
+    m_heap.clear();
+}
+
+bool IndexedMinHeap::empty() const
+{
+    return m_heap.empty();
+}
+
+bool IndexedMinHeap::contains(int handle) const
+{
+    return handle < m_positions.size() && m_positions[handle] != -1;
+}
+
+double IndexedMinHeap::topKey() const
+{
+    return m_keys[m_heap[0]];
+}
+
+void IndexedMinHeap::push(int handle, double key)
+{
+    // make room for handles we have not seen before
+    if (handle >= m_positions.size()) {
+        m_positions.resize(handle + 1, -1);
+        m_keys.resize(handle + 1);
+    }
+    m_keys[handle] = key;
+    m_heap.push_back(handle);
+    m_positions[handle] = m_heap.size() - 1;
+    siftUp(m_heap.size() - 1);
+}
+
+void IndexedMinHeap::decreaseKey(int handle, double key)
+{
+    m_keys[handle] = key;
+    siftUp(m_positions[handle]);
+}
+
+int IndexedMinHeap::popMin()
+{
+    // take the root and move the last handle to the top before restoring heap order
+    int top = m_heap[0];
+    int last = m_heap.back();
+    m_heap.pop_back();
+    m_positions[top] = -1;
+    if (!m_heap.empty()) {
+        place(0, last);
+        siftDown(0);
+    }
+    return top;
+}
+
+void IndexedMinHeap::siftUp(int pos)
+{
+    int handle = m_heap[pos];
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (m_keys[m_heap[parent]] <= m_keys[handle])
+            break;
+        place(pos, m_heap[parent]);
+        pos = parent;
+    }
+    place(pos, handle);
+}
+
+void IndexedMinHeap::siftDown(int pos)
+{
+    int handle = m_heap[pos];
+    int n = m_heap.size();
+    while (true) {
+        int child = 2 * pos + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && m_keys[m_heap[child + 1]] < m_keys[m_heap[child]])
+            child++;
+        if (m_keys[handle] <= m_keys[m_heap[child]])
+            break;
+        place(pos, m_heap[child]);
+        pos = child;
+    }
+    place(pos, handle);
+}
+
+void IndexedMinHeap::place(int pos, int handle)
+{
+    m_heap[pos] = handle;
+    m_positions[handle] = pos;
+}
+
+//******************** ShortestPathTree functions *****************************
+
+ShortestPathTree::ShortestPathTree()
+{
+    clear();
+}
+
+void ShortestPathTree::clear()
+{
+    m_source = -1;
+    m_targets.clear();
+    m_distances.clear();
+    m_targetEntries.clear();
+    m_nodes.clear();
+    m_parents.clear();
+    m_edges.clear();
+}
+
+int ShortestPathTree::getSource() const
+{
+    return m_source;
+}
+
+int ShortestPathTree::getTargetCount() const
+{
+    return m_targets.size();
+}
+
+int ShortestPathTree::getTarget(int i) const
+{
+    return m_targets[i];
+}
+
+bool ShortestPathTree::isReached(int i) const
+{
+    return m_targetEntries[i] != -1;
+}
+
+double ShortestPathTree::getDistance(int i) const
+{
+    return m_distances[i];
+}
+
+bool ShortestPathTree::getEdgesFromSource(int i, vector<int>& edges) const
+{
+    // climb from the target to the source, then turn the edges around into route order
+    edges.clear();
+    if (!isReached(i))
+        return false;
+    for (int entry = m_targetEntries[i]; entry != 0; entry = m_parents[entry])
+        edges.push_back(m_edges[entry]);
+    reverse(edges.begin(), edges.end());
+    return true;
+}
+
+bool ShortestPathTree::getEdgesToSource(const StreetGraph& graph, int i, vector<int>& edges) const
+{
+    // climbing from the target already goes the right way; each edge is swapped for the
+    // one going back along the same segment
+    edges.clear();
+    if (!isReached(i))
+        return false;
+    for (int entry = m_targetEntries[i]; entry != 0; entry = m_parents[entry])
+        edges.push_back(graph.getReverseEdge(m_nodes[m_parents[entry]], m_edges[entry]));
+    return true;
+}
+
+void ShortestPathTree::reset(int source, const vector<int>& targets)
+{
+    clear();
+    m_source = source;
+    m_targets = targets;
+    m_distances.assign(targets.size(), numeric_limits<double>::infinity());
+    m_targetEntries.assign(targets.size(), -1);
+    addEntry(source, -1, -1);
+}
+
+int ShortestPathTree::addEntry(int node, int parent, int edge)
+{
+    m_nodes.push_back(node);
+    m_parents.push_back(parent);
+    m_edges.push_back(edge);
+    return m_nodes.size() - 1;
+}
+
+void ShortestPathTree::setReached(int i, int entry, double distance)
+{
+    m_targetEntries[i] = entry;
+    m_distances[i] = distance;
+}
+
+//******************** RouteEngine functions **********************************
+
+RouteEngine::SearchWorkspace::SearchWorkspace()
+:   m_generation(0), m_activeLandmarks(ACTIVE_LANDMARKS)
+{
+}
+
+RouteEngine::RouteEngine(const StreetMap* sm)
+:   m_StreetMap(sm), m_graph(sm->getGraph()), m_work(nullptr), m_settled(0)
+{
+}
+
+bool RouteEngine::findRoute(int start, int end, RouteSearchMode mode, vector<int>& edges, double& distance) const
+{
+    // clear the given variables of any past values
+    edges.clear();
+    distance = 0;
+    m_settled = 0;
+    
+    // a route from a node to itself is empty
+    if (start == end)
+        return true;
+    
+    beginSearch();
+    const ContractionHierarchy* hierarchy = m_StreetMap->getHierarchy();
+    if (mode == SEARCH_CONTRACTION_HIERARCHY && hierarchy != nullptr)
+        return searchHierarchy(*hierarchy, start, end, edges, distance);
+    if (mode == SEARCH_BIDIRECTIONAL)
+        return searchBidirectional(start, end, edges, distance);
+    
+    // straight-line distance to the end never overestimates the road distance left (the
+    // chord through the earth is shorter still, and cheaper to work out), and
+    // neither does any landmark's triangle-inequality bound, so their maximum is a
+    // tighter estimate that is still safe
+    const LandmarkTable* landmarks = m_StreetMap->getLandmarks();
+    if (mode == SEARCH_LANDMARKS && landmarks != nullptr) {
+        int nActive = landmarks->selectActive(start, end, m_work->m_activeLandmarks.data(), ACTIVE_LANDMARKS);
+        const int* active = m_work->m_activeLandmarks.data();
+        return searchAStar(start, end, [this, landmarks, end, active, nActive](int node) {
+            return max(m_graph->estimateMiles(node, end), landmarks->lowerBound(node, end, active, nActive));
+        }, edges, distance);
+    }
+    return searchAStar(start, end, [this, end](int node) {
+        return m_graph->estimateMiles(node, end);
+    }, edges, distance);
+}
+
+void RouteEngine::findDistances(int source, const vector<int>& targets, double* distances) const
+{
+    settleTargets(source, targets);
+    const SearchSpace& s = m_work->m_forward;
+    for (int i = 0; i < targets.size(); i++) {
+        if (s.m_closedStamp[targets[i]] == m_work->m_generation)
+            distances[i] = s.m_distance[targets[i]];
+        else
+            distances[i] = numeric_limits<double>::infinity();
+    }
+}
+
+void RouteEngine::findTree(int source, const vector<int>& targets, ShortestPathTree& tree) const
+{
+    settleTargets(source, targets);
+    const SearchSpace& s = m_work->m_forward;
+    
+    // copy out the branch to each target, walking back from it until reaching a node the
+    // tree already has (the source at the latest), then adding that stretch top down so
+    // every entry comes after its parent
+    tree.reset(source, targets);
+    m_work->m_treeStamp[source] = m_work->m_generation;
+    m_work->m_treeEntry[source] = 0;
+    for (int i = 0; i < targets.size(); i++) {
+        int target = targets[i];
+        if (s.m_closedStamp[target] != m_work->m_generation)
+            continue;
+        m_work->m_chain.clear();
+        for (int node = target; m_work->m_treeStamp[node] != m_work->m_generation; node = s.m_previousWayPoint[node])
+            m_work->m_chain.push_back(node);
+        for (int k = m_work->m_chain.size() - 1; k >= 0; k--) {
+            int node = m_work->m_chain[k];
+            int parent = m_work->m_treeEntry[s.m_previousWayPoint[node]];
+            m_work->m_treeStamp[node] = m_work->m_generation;
+            m_work->m_treeEntry[node] = tree.addEntry(node, parent, s.m_previousEdge[node]);
+        }
+        tree.setReached(i, m_work->m_treeEntry[target], s.m_distance[target]);
+    }
+}
+
+int RouteEngine::getSettledCount() const
+{
+    return m_settled;
+}
+
+void RouteEngine::computeDistanceMatrix(const StreetMap* sm, const vector<int>& nodes, vector<double>& matrix)
+{
+    int n = nodes.size();
+    matrix.assign((long long)n * n, numeric_limits<double>::infinity());
+    if (n == 0)
+        return;
+    
+    const ContractionHierarchy* hierarchy = sm->getHierarchy();
+    if (hierarchy != nullptr) {
+        computeHierarchyMatrix(sm, *hierarchy, nodes, matrix);
+        return;
+    }
+    
+    // otherwise one Dijkstra per source, each stopping once it has settled every node; the
+    // sources are dealt out to one block per thread so each block needs only one engine
+    ThreadPool& pool = ThreadPool::shared();
+    int nBlocks = min(n, pool.size());
+    pool.parallelFor(nBlocks, [&](int b) {
+        RouteEngine engine(sm);
+        for (int i = b; i < n; i += nBlocks)
+            engine.findDistances(nodes[i], nodes, &matrix[(long long)i * n]);
+    });
+}
+
+void RouteEngine::computeHierarchyMatrix(const StreetMap* sm, const ContractionHierarchy& hierarchy,
+                                         const vector<int>& nodes, vector<double>& matrix)
+{
+    // Many-to-many with buckets: the upward search from each node leaves (node, distance)
+    // in a bucket at every node it settles. The upward search from a source then meets each
+    // other node's search at the top of their shortest route, where the source's distance
+    // plus the bucket's gives the road distance.
+    struct BucketEntry {
+        int m_node;         // node whose bucket this goes in
+        int m_index;        // index into nodes of the search that left it
+        double m_distance;
+    };
+    
+    ThreadPool& pool = ThreadPool::shared();
+    int n = nodes.size();
+    int nBlocks = min(n, pool.size());
+    
+    // upward searches from every node, each block collecting its own entries
+    vector<vector<BucketEntry>> blockEntries(nBlocks);
+    pool.parallelFor(nBlocks, [&](int b) {
+        RouteEngine engine(sm);
+        for (int i = b; i < n; i += nBlocks) {
+            engine.searchUpward(hierarchy, nodes[i], [&](int node, double distance) {
+                BucketEntry entry = { node, i, distance };
+                blockEntries[b].push_back(entry);
+            });
+        }
+    });
+    
+    // gather the entries into buckets by node, in compressed sparse row form
+    int nNodes = sm->getGraph()->getNodeCount();
+    vector<int> bucketStarts(nNodes + 1, 0);
+    for (const vector<BucketEntry>& entries : blockEntries) {
+        for (const BucketEntry& entry : entries)
+            bucketStarts[entry.m_node + 1]++;
+    }
+    for (int node = 0; node < nNodes; node++)
+        bucketStarts[node + 1] += bucketStarts[node];
+    vector<BucketEntry> buckets(bucketStarts[nNodes]);
+    vector<int> next(bucketStarts.begin(), bucketStarts.end() - 1);
+    for (const vector<BucketEntry>& entries : blockEntries) {
+        for (const BucketEntry& entry : entries)
+            buckets[next[entry.m_node]++] = entry;
+    }
+    vector<vector<BucketEntry>>().swap(blockEntries);
+    
+    // upward searches again, now scanning the buckets of every node settled; each source
+    // only writes its own row
+    pool.parallelFor(nBlocks, [&](int b) {
+        RouteEngine engine(sm);
+        for (int i = b; i < n; i += nBlocks) {
+            double* row = &matrix[(long long)i * n];
+            engine.searchUpward(hierarchy, nodes[i], [&](int node, double distance) {
+                for (int k = bucketStarts[node]; k < bucketStarts[node + 1]; k++) {
+                    double through = distance + buckets[k].m_distance;
+                    if (through < row[buckets[k].m_index])
+                        row[buckets[k].m_index] = through;
+                }
+            });
+        }
+    });
+}
+
+RouteEngine::SearchWorkspace& RouteEngine::threadWorkspace()
+{
+    thread_local SearchWorkspace workspace;
+    return workspace;
+}
+
+void RouteEngine::beginSearch() const
+{
+    // search in the calling thread's state, growing it if the map has more nodes than the
+    // thread has seen before
+    m_work = &threadWorkspace();
+    int nNodes = m_graph->getNodeCount();
+    if (m_work->m_forward.m_reachedStamp.size() < nNodes) {
+        resize(m_work->m_forward, nNodes);
+        resize(m_work->m_backward, nNodes);
+        m_work->m_targetStamp.resize(nNodes, 0);
+        m_work->m_treeStamp.resize(nNodes, 0);
+        m_work->m_treeEntry.resize(nNodes);
+    }
+    
+    // moving to a new generation invalidates every entry of the previous search at once;
+    // only when the counter wraps around do the stamps need to be cleared for real
+    m_work->m_generation++;
+    if (m_work->m_generation == 0) {
+        SearchSpace* spaces[2] = { &m_work->m_forward, &m_work->m_backward };
+        for (SearchSpace* space : spaces) {
+            fill(space->m_reachedStamp.begin(), space->m_reachedStamp.end(), 0);
+            fill(space->m_closedStamp.begin(), space->m_closedStamp.end(), 0);
+        }
+        fill(m_work->m_targetStamp.begin(), m_work->m_targetStamp.end(), 0);
+        fill(m_work->m_treeStamp.begin(), m_work->m_treeStamp.end(), 0);
+        m_work->m_generation = 1;
+    }
+    m_work->m_forward.m_open.clear();
+    m_work->m_backward.m_open.clear();
+}
+
+// Dijkstra from node source until every one of targets has its distance final (or the
+// rest of the map cannot be reached), leaving the search in m_work->m_forward
+void RouteEngine::settleTargets(int source, const vector<int>& targets) const
+{
+    // mark the targets, counting each distinct one once
+    m_settled = 0;
+    beginSearch();
+    int nLeft = 0;
+    for (int t : targets) {
+        if (m_work->m_targetStamp[t] != m_work->m_generation) {
+            m_work->m_targetStamp[t] = m_work->m_generation;
+            nLeft++;
+        }
+    }
+    
+    SearchSpace& s = m_work->m_forward;
+    reach(s, source, 0, -1, -1);
+    s.m_open.push(source, 0);
+    while (!s.m_open.empty() && nLeft > 0) {
+        int current = s.m_open.popMin();
+        s.m_closedStamp[current] = m_work->m_generation;
+        m_settled++;
+        if (m_work->m_targetStamp[current] == m_work->m_generation)
+            nLeft--;
+        
+        for (int e : m_graph->getEdges(current)) {
+            int next = m_graph->getEdgeTarget(e);
+            if (s.m_closedStamp[next] == m_work->m_generation)
+                continue;
+            double newDistance = s.m_distance[current] + m_graph->getEdgeLength(e);
+            if (s.m_reachedStamp[next] == m_work->m_generation && newDistance >= s.m_distance[next])
+                continue;
+            reach(s, next, newDistance, current, e);
+            if (s.m_open.contains(next))
+                s.m_open.decreaseKey(next, newDistance);
+            else
+                s.m_open.push(next, newDistance);
+        }
+    }
+}
+
+void RouteEngine::resize(SearchSpace& space, int nNodes) const
+{
+    space.m_reachedStamp.resize(nNodes, 0);
+    space.m_closedStamp.resize(nNodes, 0);
+    space.m_distance.resize(nNodes);
+    space.m_previousWayPoint.resize(nNodes);
+    space.m_previousEdge.resize(nNodes);
+}
+
+void RouteEngine::reach(SearchSpace& space, int node, double distance, int previousWayPoint, int previousEdge) const
+{
+    space.m_reachedStamp[node] = m_work->m_generation;
+    space.m_distance[node] = distance;
+    space.m_previousWayPoint[node] = previousWayPoint;
+    space.m_previousEdge[node] = previousEdge;
+}
+
+template<typename Heuristic>
+bool RouteEngine::searchAStar(int start, int end, const Heuristic& estimate, vector<int>& edges, double& distance) const
+{
+    SearchSpace& s = m_work->m_forward;
+    reach(s, start, 0, -1, -1);
+    
+    // open set ordered by distance so far plus the estimate of the road distance left to
+    // the end, which never overestimates it
+    s.m_open.push(start, estimate(start));
+    
+    bool pathFound = false;
+    while (!s.m_open.empty()) {
+        // take the most promising node; once the end comes off the heap its distance is optimal
+        int current = s.m_open.popMin();
+        if (current == end) {
+            pathFound = true;
+            break;
+        }
+        s.m_closedStamp[current] = m_work->m_generation;
+        m_settled++;
+        
+        // relax every edge leaving the current node
+        for (int e : m_graph->getEdges(current)) {
+            int next = m_graph->getEdgeTarget(e);
+            if (s.m_closedStamp[next] == m_work->m_generation)
+                continue;
+            
+            // keep the new path if this is the first time we have reached the neighbor
+            // or if it is shorter than the one we already had
+            double newDistance = s.m_distance[current] + m_graph->getEdgeLength(e);
+            bool reached = s.m_reachedStamp[next] == m_work->m_generation;
+            if (reached && newDistance >= s.m_distance[next])
+                continue;
+            reach(s, next, newDistance, current, e);
+            
+            double key = newDistance + estimate(next);
+            if (s.m_open.contains(next))
+                s.m_open.decreaseKey(next, key);
+            else
+                s.m_open.push(next, key);
+        }
+    }
+    
+    // if the end was never reached, there is no route
+    if (!pathFound)
+        return false;
+    
+    // walk back from the end to the start, then put the edges in travel order
+    for (int i = end; s.m_previousWayPoint[i] != -1; i = s.m_previousWayPoint[i])
+        edges.push_back(s.m_previousEdge[i]);
+    reverse(edges.begin(), edges.end());
+    distance = s.m_distance[end];
+    return true;
+}
+
+bool RouteEngine::searchBidirectional(int start, int end, vector<int>& edges, double& distance) const
+{
+    // Both searches use the average of the two straight-line estimates as their potential:
+    // forward keys add p(v) = (h(v, end) - h(start, v)) / 2 and backward keys subtract it.
+    // With that choice both directions see the same nonnegative reduced edge lengths, so
+    // this is a bidirectional Dijkstra on the reduced graph, and it can stop as soon as the
+    // smallest keys of the two open sets add up to at least the best route found so far.
+    // Every segment is stored in both directions, so the backward search walks the same
+    // edges as the forward one.
+    auto potential = [this, start, end](int node) {
+        return (m_graph->estimateMiles(node, end) - m_graph->estimateMiles(start, node)) / 2;
+    };
+    
+    reach(m_work->m_forward, start, 0, -1, -1);
+    m_work->m_forward.m_open.push(start, potential(start));
+    reach(m_work->m_backward, end, 0, -1, -1);
+    m_work->m_backward.m_open.push(end, -potential(end));
+    
+    double best = numeric_limits<double>::infinity();
+    int meeting = -1;
+    while (!m_work->m_forward.m_open.empty() && !m_work->m_backward.m_open.empty()) {
+        // stop once no route through an unsettled node can beat the best one found
+        if (m_work->m_forward.m_open.topKey() + m_work->m_backward.m_open.topKey() >= best)
+            break;
+        
+        // advance whichever direction has the smaller key
+        bool forward = m_work->m_forward.m_open.topKey() <= m_work->m_backward.m_open.topKey();
+        SearchSpace& s = forward ? m_work->m_forward : m_work->m_backward;
+        SearchSpace& other = forward ? m_work->m_backward : m_work->m_forward;
+        double sign = forward ? 1 : -1;
+        
+        int current = s.m_open.popMin();
+        s.m_closedStamp[current] = m_work->m_generation;
+        m_settled++;
+        
+        // relax every edge leaving the current node
+        for (int e : m_graph->getEdges(current)) {
+            int next = m_graph->getEdgeTarget(e);
+            if (s.m_closedStamp[next] == m_work->m_generation)
+                continue;
+            
+            double newDistance = s.m_distance[current] + m_graph->getEdgeLength(e);
+            bool reached = s.m_reachedStamp[next] == m_work->m_generation;
+            if (reached && newDistance >= s.m_distance[next])
+                continue;
+            reach(s, next, newDistance, current, e);
+            
+            double key = newDistance + sign * potential(next);
+            if (s.m_open.contains(next))
+                s.m_open.decreaseKey(next, key);
+            else
+                s.m_open.push(next, key);
+            
+            // a node both searches have reached joins a route from start to end
+            if (other.m_reachedStamp[next] == m_work->m_generation && newDistance + other.m_distance[next] < best) {
+                best = newDistance + other.m_distance[next];
+                meeting = next;
+            }
+        }
+    }
+    
+    // if the searches never met, there is no route
+    if (meeting == -1)
+        return false;
+    
+    // the forward half, walked back from the meeting node and put in travel order
+    for (int i = meeting; m_work->m_forward.m_previousWayPoint[i] != -1; i = m_work->m_forward.m_previousWayPoint[i])
+        edges.push_back(m_work->m_forward.m_previousEdge[i]);
+    reverse(edges.begin(), edges.end());
+    
+    // the backward half arrived at each node on the edge leaving its successor on the route,
+    // so travel the other direction of that segment
+    for (int i = meeting; m_work->m_backward.m_previousWayPoint[i] != -1; i = m_work->m_backward.m_previousWayPoint[i])
+        edges.push_back(m_graph->getReverseEdge(m_work->m_backward.m_previousWayPoint[i], m_work->m_backward.m_previousEdge[i]));
+    distance = best;
+    return true;
+}
+
+bool RouteEngine::searchHierarchy(const ContractionHierarchy& hierarchy, int start, int end, vector<int>& edges, double& distance) const
+{
+    // Dijkstra upward from both ends, over up-edges only. The shortest route climbs from
+    // each end to its most important node, so it is the best meeting of the two searches;
+    // a direction can stop once its smallest key reaches the best meeting found so far.
+    reach(m_work->m_forward, start, 0, -1, -1);
+    m_work->m_forward.m_open.push(start, 0);
+    reach(m_work->m_backward, end, 0, -1, -1);
+    m_work->m_backward.m_open.push(end, 0);
+    
+    double best = numeric_limits<double>::infinity();
+    int meeting = -1;
+    while (true) {
+        // advance whichever direction has the smaller key, until neither can improve on best
+        double forwardKey = m_work->m_forward.m_open.empty() ? numeric_limits<double>::infinity() : m_work->m_forward.m_open.topKey();
+        double backwardKey = m_work->m_backward.m_open.empty() ? numeric_limits<double>::infinity() : m_work->m_backward.m_open.topKey();
+        if (min(forwardKey, backwardKey) >= best)
+            break;
+        bool forward = forwardKey <= backwardKey;
+        SearchSpace& s = forward ? m_work->m_forward : m_work->m_backward;
+        SearchSpace& other = forward ? m_work->m_backward : m_work->m_forward;
+        
+        int current = s.m_open.popMin();
+        s.m_closedStamp[current] = m_work->m_generation;
+        m_settled++;
+        
+        // a node the other direction has reached joins a route from start to end
+        if (other.m_reachedStamp[current] == m_work->m_generation && s.m_distance[current] + other.m_distance[current] < best) {
+            best = s.m_distance[current] + other.m_distance[current];
+            meeting = current;
+        }
+        
+        // if a more important neighbor offers a shorter way here, this node cannot be on a
+        // shortest route from this end, so there is no need to search on from it
+        bool stalled = false;
+        for (int up : hierarchy.getUpEdges(current)) {
+            int next = hierarchy.getUpTarget(up);
+            if (s.m_reachedStamp[next] == m_work->m_generation && s.m_distance[next] + hierarchy.getUpWeight(up) < s.m_distance[current]) {
+                stalled = true;
+                break;
+            }
+        }
+        if (stalled)
+            continue;
+        
+        // relax every up-edge leaving the current node
+        for (int up : hierarchy.getUpEdges(current)) {
+            int next = hierarchy.getUpTarget(up);
+            if (s.m_closedStamp[next] == m_work->m_generation)
+                continue;
+            double newDistance = s.m_distance[current] + hierarchy.getUpWeight(up);
+            if (s.m_reachedStamp[next] == m_work->m_generation && newDistance >= s.m_distance[next])
+                continue;
+            reach(s, next, newDistance, current, up);
+            if (s.m_open.contains(next))
+                s.m_open.decreaseKey(next, newDistance);
+            else
+                s.m_open.push(next, newDistance);
+        }
+    }
+    
+    // if the searches never met, there is no route
+    if (meeting == -1)
+        return false;
+    
+    // the up-edges from the start to the meeting node, in travel order, each unpacked into
+    // the graph edges it stands for
+    m_work->m_chain.clear();
+    for (int i = meeting; m_work->m_forward.m_previousWayPoint[i] != -1; i = m_work->m_forward.m_previousWayPoint[i])
+        m_work->m_chain.push_back(i);
+    for (int k = m_work->m_chain.size() - 1; k >= 0; k--) {
+        int node = m_work->m_chain[k];
+        hierarchy.unpack(*m_graph, m_work->m_forward.m_previousEdge[node], m_work->m_forward.m_previousWayPoint[node], node, edges);
+    }
+    
+    // then down from the meeting node to the end, against the direction the backward search went
+    for (int i = meeting; m_work->m_backward.m_previousWayPoint[i] != -1; i = m_work->m_backward.m_previousWayPoint[i])
+        hierarchy.unpack(*m_graph, m_work->m_backward.m_previousEdge[i], i, m_work->m_backward.m_previousWayPoint[i], edges);
+    
+    // add the lengths up along the route, as the other searches do, so every mode reports
+    // the same distance for the same route
+    distance = 0;
+    for (int e : edges)
+        distance += m_graph->getEdgeLength(e);
+    return true;
+}
+
+template<typename Visit>
+void RouteEngine::searchUpward(const ContractionHierarchy& hierarchy, int source, const Visit& visit) const
+{
+    // Dijkstra over up-edges only, to the top of the hierarchy, calling visit(node, distance)
+    // for every node settled that is not stalled (a stalled node's distance is not its
+    // shortest, so it cannot be where a shortest route turns down again)
+    m_settled = 0;
+    beginSearch();
+    SearchSpace& s = m_work->m_forward;
+    reach(s, source, 0, -1, -1);
+    s.m_open.push(source, 0);
+    while (!s.m_open.empty()) {
+        int current = s.m_open.popMin();
+        s.m_closedStamp[current] = m_work->m_generation;
+        m_settled++;
+        
+        bool stalled = false;
+        for (int up : hierarchy.getUpEdges(current)) {
+            int next = hierarchy.getUpTarget(up);
+            if (s.m_reachedStamp[next] == m_work->m_generation && s.m_distance[next] + hierarchy.getUpWeight(up) < s.m_distance[current]) {
+                stalled = true;
+                break;
+            }
+        }
+        if (stalled)
+            continue;
+        visit(current, s.m_distance[current]);
+        
+        for (int up : hierarchy.getUpEdges(current)) {
+            int next = hierarchy.getUpTarget(up);
+            if (s.m_closedStamp[next] == m_work->m_generation)
+                continue;
+            double newDistance = s.m_distance[current] + hierarchy.getUpWeight(up);
+            if (s.m_reachedStamp[next] == m_work->m_generation && newDistance >= s.m_distance[next])
+                continue;
+            reach(s, next, newDistance, current, up);
+            if (s.m_open.contains(next))
+                s.m_open.decreaseKey(next, newDistance);
+            else
+                s.m_open.push(next, newDistance);
+        }
+    }
+}
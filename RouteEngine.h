@@ -0,0 +1,167 @@
+// RouteEngine.h
+
+#ifndef ROUTEENGINE_INCLUDED
+#define ROUTEENGINE_INCLUDED
+
+#include <vector>
+#include "StreetGraph.h"
+
+using namespace std;
+
+// how a route is searched for; every mode finds a shortest route, they differ in how
+// much of the map they look at to find it
+enum RouteSearchMode : int
+{
+    SEARCH_ASTAR,                   // A* from the start, guided by straight-line distance to the end
+    SEARCH_BIDIRECTIONAL,           // A* from both ends at once, meeting in the middle
+    SEARCH_CONTRACTION_HIERARCHY,   // upward searches in the map's contraction hierarchy
+                                    // (A* if StreetMap::buildContractionHierarchy was not run)
+    SEARCH_LANDMARKS                // A* guided by the map's landmark distances as well
+                                    // (plain A* if StreetMap::buildLandmarks was not run)
+};
+
+class ContractionHierarchy;
+class LandmarkTable;
+
+// binary min-heap over small integer handles that remembers where each handle sits,
+// so a handle already in the heap can have its key lowered in place
+class IndexedMinHeap
+{
+public:
+    void clear();
+    bool empty() const;
+    bool contains(int handle) const;
+    double topKey() const;
+    void push(int handle, double key);
+    void decreaseKey(int handle, double key);
+    int popMin();
+private:
+    vector<int> m_heap;         // heap order of handles
+    vector<double> m_keys;      // key of each handle
+    vector<int> m_positions;    // position of each handle in m_heap, -1 if not present
+
+    // Helper Functions
+    void siftUp(int pos);
+    void siftDown(int pos);
+    void place(int pos, int handle);
+};
+
+// Shortest routes from one source node to a set of target nodes, as found by
+// RouteEngine::findTree.
+//
+// Only the branches of the search's shortest-path tree that lead to a target are kept,
+// with each node's parent and the edge from it, so the tree stays small however much of
+// the map the search looked at, and stays valid after the engine's next search. A route
+// is read off the tree when it is wanted. Every segment can be travelled both ways, so a
+// branch read backwards is a shortest route from its target to the source.
+class ShortestPathTree
+{
+public:
+    ShortestPathTree();
+    void clear();
+    int getSource() const;
+    int getTargetCount() const;
+    int getTarget(int i) const;
+    bool isReached(int i) const;
+    double getDistance(int i) const;    // infinity if target i was not reached
+
+    // fill edges with the ids of the edges from the source to target i, or from target i
+    // to the source; returns false if target i was not reached
+    bool getEdgesFromSource(int i, vector<int>& edges) const;
+    bool getEdgesToSource(const StreetGraph& graph, int i, vector<int>& edges) const;
+
+    // building, for RouteEngine::findTree: start an empty tree, add an entry (returning
+    // its number) once its parent has one, and record where target i ended up
+    void reset(int source, const vector<int>& targets);
+    int addEntry(int node, int parent, int edge);
+    void setReached(int i, int entry, double distance);
+
+private:
+    int m_source;
+    vector<int> m_targets;
+    vector<double> m_distances;
+    vector<int> m_targetEntries;    // tree entry of each target, -1 if not reached
+    vector<int> m_nodes;            // node of each entry; entry 0 is the source
+    vector<int> m_parents;          // entry we arrived from, which always comes earlier
+    vector<int> m_edges;            // edge we arrived on (leaving the parent's node)
+};
+
+// Shortest route searches over a StreetMap's graph and indices, working in node and edge ids.
+//
+// The search state is indexed by node id and kept between queries, so a search does
+// not allocate or clear anything; an entry only counts for the current search if its
+// stamp equals the current generation. The state belongs to the thread rather than the
+// engine: every engine a thread uses (whatever map it is on) shares that thread's
+// workspace, which only grows when a bigger map comes along, so making an engine costs
+// nothing and a thread's searches stop allocating once the first has run. One engine
+// must not be used by two threads at once; give each thread its own.
+class RouteEngine
+{
+public:
+    RouteEngine(const StreetMap* sm);
+
+    // find a shortest route from node start to node end, filling edges with the ids of the
+    // edges along it in order; returns false if end cannot be reached from start
+    bool findRoute(int start, int end, RouteSearchMode mode, vector<int>& edges, double& distance) const;
+
+    // fill distances with the road distance from node source to each of targets (infinity
+    // where there is no route), searching only until every target has been settled
+    void findDistances(int source, const vector<int>& targets, double* distances) const;
+
+    // the same search, keeping the shortest routes to the targets in tree
+    void findTree(int source, const vector<int>& targets, ShortestPathTree& tree) const;
+
+    // number of nodes the last search settled, for comparing search modes
+    int getSettledCount() const;
+
+    // fill matrix with the road distance from every one of nodes to every other, row by row
+    // (nodes.size() squared entries, infinity where there is no route); sources are worked
+    // on in parallel, and the map's contraction hierarchy is used if it has one
+    static void computeDistanceMatrix(const StreetMap* sm, const vector<int>& nodes, vector<double>& matrix);
+
+private:
+    // the state of a search in one direction
+    struct SearchSpace {
+        vector<unsigned int> m_reachedStamp;    // distance and previous way point are valid
+        vector<unsigned int> m_closedStamp;     // distance is final
+        vector<double> m_distance;              // best known road distance from the search's source
+        vector<int> m_previousWayPoint;         // node we arrived from
+        vector<int> m_previousEdge;             // edge we arrived on (leaving the previous way point)
+        IndexedMinHeap m_open;
+    };
+
+    // everything a search works in, kept per thread
+    struct SearchWorkspace {
+        SearchWorkspace();
+        unsigned int m_generation;
+        SearchSpace m_forward;
+        SearchSpace m_backward;
+        vector<int> m_chain;
+        vector<int> m_activeLandmarks;
+        vector<unsigned int> m_targetStamp;     // node is one of findDistances' targets
+        vector<unsigned int> m_treeStamp;       // node has an entry in the tree being built
+        vector<int> m_treeEntry;
+    };
+
+    const StreetMap* m_StreetMap;
+    const StreetGraph* m_graph;
+    mutable SearchWorkspace* m_work;    // the searching thread's, set by beginSearch
+    mutable int m_settled;
+
+    // Helper Functions
+    static SearchWorkspace& threadWorkspace();
+    void beginSearch() const;
+    void resize(SearchSpace& space, int nNodes) const;
+    void reach(SearchSpace& space, int node, double distance, int previousWayPoint, int previousEdge) const;
+    void settleTargets(int source, const vector<int>& targets) const;
+    template<typename Heuristic>
+    bool searchAStar(int start, int end, const Heuristic& estimate, vector<int>& edges, double& distance) const;
+    bool searchBidirectional(int start, int end, vector<int>& edges, double& distance) const;
+    bool searchHierarchy(const ContractionHierarchy& hierarchy, int start, int end, vector<int>& edges, double& distance) const;
+    template<typename Visit>
+    void searchUpward(const ContractionHierarchy& hierarchy, int source, const Visit& visit) const;
+    static void computeHierarchyMatrix(const StreetMap* sm, const ContractionHierarchy& hierarchy,
+                                       const vector<int>& nodes, vector<double>& matrix);
+};
+
+#endif
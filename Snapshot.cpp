@@ -0,0 +1,213 @@
+#include "Snapshot.h"
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char SNAPSHOT_MAGIC[8] = { 'S', 'T', 'R', 'E', 'E', 'T', 'S', 'S' };
+static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+static const long long SNAPSHOT_ALIGNMENT = 64;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;     // written as SNAPSHOT_BYTE_ORDER; reads back differently on a machine of the other endianness
+    uint32_t sectionCount;
+    uint32_t reserved;
+};
+
+struct SnapshotSectionEntry
+{
+    uint32_t tag;
+    uint32_t reserved;
+    int64_t offset;         // from the start of the file
+    int64_t bytes;
+};
+
+// round n up to the next multiple of the section alignment
+static long long alignUp(long long n)
+{
+    return (n + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+//******************** SnapshotWriter functions *******************************
+
+void SnapshotWriter::addSection(unsigned int tag, const void* data, long long bytes)
+{
+    Section s;
+    s.m_tag = tag;
+    s.m_data = data;
+    s.m_bytes = bytes;
+    m_sections.push_back(s);
+}
+
+bool SnapshotWriter::write(const string& fileName) const
+{
+    ofstream file(fileName, ios::binary | ios::trunc);
+    if (!file)
+        return false;
+
+    // header
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.sectionCount = m_sections.size();
+    header.reserved = 0;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // section table, laying the sections out one after another on aligned offsets
+    long long offset = alignUp(sizeof(SnapshotHeader) + m_sections.size() * sizeof(SnapshotSectionEntry));
+    for (int i = 0; i < m_sections.size(); i++) {
+        SnapshotSectionEntry entry;
+        entry.tag = m_sections[i].m_tag;
+        entry.reserved = 0;
+        entry.offset = offset;
+        entry.bytes = m_sections[i].m_bytes;
+        file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        offset = alignUp(offset + m_sections[i].m_bytes);
+    }
+
+    // sections, each padded with zeros up to the next aligned offset
+    static const char padding[SNAPSHOT_ALIGNMENT] = {};
+    long long written = sizeof(SnapshotHeader) + m_sections.size() * sizeof(SnapshotSectionEntry);
+    for (int i = 0; i < m_sections.size(); i++) {
+        file.write(padding, alignUp(written) - written);
+        written = alignUp(written);
+        file.write(static_cast<const char*>(m_sections[i].m_data), m_sections[i].m_bytes);
+        written += m_sections[i].m_bytes;
+    }
+
+    return bool(file);
+}
+
+//******************** MappedSnapshot functions *******************************
+
+MappedSnapshot::MappedSnapshot()
+:   m_data(nullptr), m_size(0)
+{
+}
+
+MappedSnapshot::~MappedSnapshot()
+{
+    close();
+}
+
+bool MappedSnapshot::open(const string& fileName)
+{
+    close();
+
+#if !defined(_WIN32)
+    // map the whole file read-only and shared, so every process using the same snapshot
+    // is backed by the same pages of the page cache
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SnapshotHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+    m_data = static_cast<const char*>(mapped);
+    m_size = info.st_size;
+#else
+    // without mmap, read the file into memory in one block instead
+    ifstream file(fileName, ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, ios::end);
+    long long size = file.tellg();
+    file.seekg(0, ios::beg);
+    if (size < (long long)sizeof(SnapshotHeader))
+        return false;
+    m_copy.resize(size);
+    if (!file.read(m_copy.data(), size))
+        return false;
+    m_data = m_copy.data();
+    m_size = size;
+#endif
+
+    // check that this is a snapshot this program can read
+    const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(m_data);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        header->byteOrder != SNAPSHOT_BYTE_ORDER ||
+        sizeof(SnapshotHeader) + (long long)header->sectionCount * sizeof(SnapshotSectionEntry) > m_size) {
+        close();
+        return false;
+    }
+
+    // check that every section lies inside the file
+    const SnapshotSectionEntry* entries = reinterpret_cast<const SnapshotSectionEntry*>(m_data + sizeof(SnapshotHeader));
+    for (int i = 0; i < header->sectionCount; i++) {
+        if (entries[i].offset < 0 || entries[i].bytes < 0 || entries[i].offset % SNAPSHOT_ALIGNMENT != 0 ||
+            entries[i].offset + entries[i].bytes > m_size) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MappedSnapshot::close()
+{
+#if !defined(_WIN32)
+    if (m_data != nullptr)
+        munmap(const_cast<char*>(m_data), m_size);
+#else
+    vector<char>().swap(m_copy);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+bool MappedSnapshot::isOpen() const
+{
+    return m_data != nullptr;
+}
+
+long long MappedSnapshot::fileSize() const
+{
+    return m_size;
+}
+
+bool MappedSnapshot::findSection(unsigned int tag, const void*& data, long long& bytes) const
+{
+    if (m_data == nullptr)
+        return false;
+
+    // look the tag up in the section table
+    const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(m_data);
+    const SnapshotSectionEntry* entries = reinterpret_cast<const SnapshotSectionEntry*>(m_data + sizeof(SnapshotHeader));
+    for (int i = 0; i < header->sectionCount; i++) {
+        if (entries[i].tag == tag) {
+            data = m_data + entries[i].offset;
+            bytes = entries[i].bytes;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isSnapshotFile(const string& fileName)
+{
+    // only the magic bytes are checked here; open() validates the rest
+    ifstream file(fileName, ios::binary);
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    if (!file.read(magic, sizeof(magic)))
+        return false;
+    return memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+}
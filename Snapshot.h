@@ -0,0 +1,191 @@
+// Snapshot.h
+
+#ifndef SNAPSHOT_INCLUDED
+#define SNAPSHOT_INCLUDED
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+// Array of plain values that either owns its elements (when a map is built from text) or
+// only points at elements that live in a memory-mapped snapshot file. Either way it is
+// read the same way, so the graph does not care where its arrays came from. An attached
+// array is read-only and stays valid only while the snapshot it points into is open.
+template<typename T>
+class MappedArray
+{
+public:
+    MappedArray() : m_data(nullptr), m_size(0) {}
+    int size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const T* data() const { return m_data; }
+    const T& operator[](int i) const { return m_data[i]; }
+
+    // building an owned array
+    void clear();
+    void reserve(int n);
+    void push_back(const T& value);
+    void append(const T* values, int count);
+    void adopt(vector<T>& values);
+
+    // viewing elements owned by a snapshot
+    void attach(const T* data, int size);
+
+    MappedArray(const MappedArray&) = delete;
+    MappedArray& operator=(const MappedArray&) = delete;
+
+private:
+    vector<T> m_owned;
+    const T* m_data;
+    int m_size;
+};
+
+template<typename T>
+void MappedArray<T>::clear()
+{
+    vector<T>().swap(m_owned);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+template<typename T>
+void MappedArray<T>::reserve(int n)
+{
+    m_owned.reserve(n);
+    m_data = m_owned.data();
+}
+
+template<typename T>
+void MappedArray<T>::push_back(const T& value)
+{
+    m_owned.push_back(value);
+    m_data = m_owned.data();
+    m_size = m_owned.size();
+}
+
+template<typename T>
+void MappedArray<T>::append(const T* values, int count)
+{
+    m_owned.insert(m_owned.end(), values, values + count);
+    m_data = m_owned.data();
+    m_size = m_owned.size();
+}
+
+template<typename T>
+void MappedArray<T>::adopt(vector<T>& values)
+{
+    // take over the vector's elements without copying them
+    m_owned.swap(values);
+    vector<T>().swap(values);
+    m_data = m_owned.data();
+    m_size = m_owned.size();
+}
+
+template<typename T>
+void MappedArray<T>::attach(const T* data, int size)
+{
+    vector<T>().swap(m_owned);
+    m_data = data;
+    m_size = size;
+}
+
+// Versioned binary snapshot of a compiled street map.
+//
+// The file is a small header followed by a table of sections and then the sections
+// themselves. Every section is a raw array identified by a tag and starts on a 64 byte
+// boundary, so once the file is mapped into memory each array can be used in place with
+// no parsing and no copying; processes that map the same file share its pages. Sections
+// a reader does not know about are ignored, so new precomputed indices can be added
+// without breaking older snapshots.
+
+const unsigned int SNAPSHOT_VERSION = 1;
+
+// tags of the sections a snapshot can hold
+enum SnapshotSectionTag
+{
+    SECTION_NODE_LATITUDES = 1,
+    SECTION_NODE_LONGITUDES,
+    SECTION_COORD_TEXT,
+    SECTION_COORD_TEXT_OFFSETS,
+    SECTION_NODES_BY_KEY,
+    SECTION_EDGE_OFFSETS,
+    SECTION_EDGE_TARGETS,
+    SECTION_EDGE_LENGTHS,
+    SECTION_EDGE_STREETS,
+    SECTION_NAME_TEXT,
+    SECTION_NAME_OFFSETS,
+    SECTION_CH_RANKS,
+    SECTION_CH_UP_OFFSETS,
+    SECTION_CH_UP_TARGETS,
+    SECTION_CH_UP_WEIGHTS,
+    SECTION_CH_UP_EDGES,
+    SECTION_CH_UP_MIDDLES,
+    SECTION_CH_UP_LOWER_CHILDREN,
+    SECTION_CH_UP_HIGHER_CHILDREN,
+    SECTION_LANDMARK_NODES,
+    SECTION_LANDMARK_DISTANCES,
+    SECTION_NODE_UNIT_VECTORS       // worked out again at load if a snapshot lacks it
+};
+
+// collects the arrays of a snapshot and writes them out
+class SnapshotWriter
+{
+public:
+    void addSection(unsigned int tag, const void* data, long long bytes);
+    bool write(const string& fileName) const;
+
+private:
+    struct Section {
+        unsigned int m_tag;
+        const void* m_data;
+        long long m_bytes;
+    };
+    vector<Section> m_sections;
+};
+
+// a snapshot file mapped read-only into memory
+class MappedSnapshot
+{
+public:
+    MappedSnapshot();
+    ~MappedSnapshot();
+    bool open(const string& fileName);
+    void close();
+    bool isOpen() const;
+    long long fileSize() const;
+
+    // find the section with the given tag, returning false if the snapshot does not have it
+    bool findSection(unsigned int tag, const void*& data, long long& bytes) const;
+
+    // point array at the section with the given tag, which must hold exactly count elements
+    // (or any whole number of elements if count is -1)
+    template<typename T>
+    bool attach(unsigned int tag, MappedArray<T>& array, int count = -1) const;
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+private:
+    const char* m_data;
+    long long m_size;
+    vector<char> m_copy;    // file contents on systems without memory mapping
+};
+
+template<typename T>
+bool MappedSnapshot::attach(unsigned int tag, MappedArray<T>& array, int count) const
+{
+    const void* data;
+    long long bytes;
+    if (!findSection(tag, data, bytes) || bytes % sizeof(T) != 0)
+        return false;
+    if (count != -1 && bytes != (long long)count * sizeof(T))
+        return false;
+    array.attach(static_cast<const T*>(data), bytes / sizeof(T));
+    return true;
+}
+
+// return whether the file starts like a snapshot (as opposed to a text map file)
+bool isSnapshotFile(const string& fileName);
+
+#endif
@@ -0,0 +1,439 @@
+#include "StreetGraph.h"
+#include <string>
+#include <vector>
+#include <list>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include "ThreadPool.h"
+
+using namespace std;
+
+unsigned int hasher(const string& s)
+{
+    return hash<string>()(s);
+}
+
+unsigned int hasher(const CoordKey& k)
+{
+    // multiply the packed coordinate by a large odd constant and keep the high bits,
+    // where every bit of both halves has had a chance to mix
+    unsigned long long packed = (unsigned long long)(unsigned int)k.latitude << 32 | (unsigned int)k.longitude;
+    packed *= 0x9e3779b97f4a7c15ULL;
+    return packed >> 32;
+}
+
+// order coordinates by latitude, then longitude
+static bool keyLess(int latitude1, int longitude1, int latitude2, int longitude2)
+{
+    if (latitude1 != latitude2)
+        return latitude1 < latitude2;
+    return longitude1 < longitude2;
+}
+
+StreetGraph::StreetGraph()
+:   m_compiled(false)
+{
+    clear();
+}
+
+void StreetGraph::clear()
+{
+    // release anything built or mapped before
+    m_snapshot.close();
+    m_latitudes.clear();
+    m_longitudes.clear();
+    m_coordText.clear();
+    m_coordTextOffsets.clear();
+    m_coordTextOffsets.push_back(0);
+    m_nodesByKey.clear();
+    m_unitVectors.clear();
+    m_offsets.clear();
+    m_offsets.push_back(0);
+    m_targets.clear();
+    m_lengths.clear();
+    m_streets.clear();
+    m_nameText.clear();
+    m_nameOffsets.clear();
+    m_nameOffsets.push_back(0);
+    m_nodeIds.reset();
+    m_streetIds.reset();
+    m_pending.clear();
+    m_compiled = false;
+    m_loadStatistics = LoadStatistics();
+}
+
+void StreetGraph::reserve(int nNodes, int nSegments, int nStreets)
+{
+    // size the tables for what is about to be added so none of them regrow while loading;
+    // a coordinate's text is typically around ten characters per value (the node lookup
+    // table is left to grow, as loaders that append nodes never use it)
+    m_latitudes.reserve(nNodes);
+    m_longitudes.reserve(nNodes);
+    m_coordText.reserve(nNodes * 24);
+    m_coordTextOffsets.reserve(2 * nNodes + 1);
+    m_streetIds.reserve(nStreets);
+    m_nameOffsets.reserve(nStreets + 1);
+    m_pending.reserve(nSegments);
+}
+
+int StreetGraph::addNode(const GeoCoord& gc)
+{
+    // return the existing id of the coordinate, or give it the next free id
+    CoordKey key = makeCoordKey(gc);
+    int found = findNode(key);
+    if (found != -1)
+        return found;
+    return addNode(key, gc.latitudeText.data(), gc.latitudeText.size(),
+                   gc.longitudeText.data(), gc.longitudeText.size());
+}
+
+int StreetGraph::addNode(const CoordKey& key, const char* latitudeText, int latitudeLength,
+                         const char* longitudeText, int longitudeLength)
+{
+    // give a coordinate the caller knows is new the next free id, and make it findable
+    int id = appendNode(key, latitudeText, latitudeLength, longitudeText, longitudeLength);
+    m_nodeIds.associate(key, id);
+    return id;
+}
+
+int StreetGraph::appendNode(const CoordKey& key, const char* latitudeText, int latitudeLength,
+                            const char* longitudeText, int longitudeLength)
+{
+    // store the next node, keeping both its numeric value and its original text
+    int id = m_latitudes.size();
+    m_latitudes.push_back(key.latitude);
+    m_longitudes.push_back(key.longitude);
+    m_coordText.append(latitudeText, latitudeLength);
+    m_coordTextOffsets.push_back(m_coordText.size());
+    m_coordText.append(longitudeText, longitudeLength);
+    m_coordTextOffsets.push_back(m_coordText.size());
+    return id;
+}
+
+int StreetGraph::addStreetName(const string& name)
+{
+    // every distinct street name is stored once and referred to by its id
+    int* found = m_streetIds.find(name);
+    if (found != nullptr)
+        return *found;
+    int id = getStreetCount();
+    m_streetIds.associate(name, id);
+    m_nameText.append(name.data(), name.size());
+    m_nameOffsets.push_back(m_nameText.size());
+    return id;
+}
+
+void StreetGraph::addSegment(int from, int to, int street)
+{
+    PendingSegment p;
+    p.m_from = from;
+    p.m_to = to;
+    p.m_street = street;
+    m_pending.push_back(p);
+}
+
+void StreetGraph::compile()
+{
+    int nNodes = getNodeCount();
+    int nEdges = 2 * m_pending.size();
+
+    // count the edges leaving each node; every segment leaves both of its ends
+    vector<int> degree(nNodes, 0);
+    for (int i = 0; i < m_pending.size(); i++) {
+        degree[m_pending[i].m_from]++;
+        degree[m_pending[i].m_to]++;
+    }
+
+    // each node's edges start where the previous node's edges end
+    vector<int> offsets(nNodes + 1, 0);
+    for (int n = 0; n < nNodes; n++)
+        offsets[n + 1] = offsets[n] + degree[n];
+
+    // work out every segment's length, which is most of the work here, in parallel
+    ThreadPool& pool = ThreadPool::shared();
+    int nSegments = m_pending.size();
+    int nBlocks = min(nSegments, 8 * pool.size());
+    vector<float> segmentLengths(nSegments);
+    pool.parallelFor(nBlocks, [&](int b) {
+        int last = (long long)nSegments * (b + 1) / nBlocks;
+        for (int i = (long long)nSegments * b / nBlocks; i < last; i++)
+            segmentLengths[i] = distanceMiles(m_pending[i].m_from, m_pending[i].m_to);
+    });
+
+    // drop the segments into place, keeping the order they were loaded in for each node
+    vector<int> targets(nEdges);
+    vector<float> lengths(nEdges);
+    vector<int> streets(nEdges);
+    vector<int> next(offsets.begin(), offsets.end() - 1);
+    for (int i = 0; i < m_pending.size(); i++) {
+        const PendingSegment& p = m_pending[i];
+        float length = segmentLengths[i];
+
+        int forward = next[p.m_from]++;
+        targets[forward] = p.m_to;
+        lengths[forward] = length;
+        streets[forward] = p.m_street;
+
+        int reverse = next[p.m_to]++;
+        targets[reverse] = p.m_from;
+        lengths[reverse] = length;
+        streets[reverse] = p.m_street;
+    }
+    m_offsets.adopt(offsets);
+    m_targets.adopt(targets);
+    m_lengths.adopt(lengths);
+    m_streets.adopt(streets);
+
+    // sort the node ids by coordinate so nodes can be found by binary search from now on;
+    // slices are sorted in parallel and then merged pairwise, also in parallel
+    vector<int> nodesByKey(nNodes);
+    for (int n = 0; n < nNodes; n++)
+        nodesByKey[n] = n;
+    auto less = [this](int a, int b) {
+        return keyLess(m_latitudes[a], m_longitudes[a], m_latitudes[b], m_longitudes[b]);
+    };
+    int nSlices = nNodes < 4096 ? 1 : pool.size();
+    vector<int> bounds(nSlices + 1);
+    for (int i = 0; i <= nSlices; i++)
+        bounds[i] = (long long)nNodes * i / nSlices;
+    pool.parallelFor(nSlices, [&](int i) {
+        sort(nodesByKey.begin() + bounds[i], nodesByKey.begin() + bounds[i + 1], less);
+    });
+    for (int width = 1; width < nSlices; width *= 2) {
+        pool.parallelFor((nSlices + 2 * width - 1) / (2 * width), [&](int i) {
+            int first = 2 * width * i;
+            int middle = min(first + width, nSlices);
+            int last = min(first + 2 * width, nSlices);
+            inplace_merge(nodesByKey.begin() + bounds[first], nodesByKey.begin() + bounds[middle],
+                          nodesByKey.begin() + bounds[last], less);
+        });
+    }
+    m_nodesByKey.adopt(nodesByKey);
+    computeUnitVectors();
+
+    // the loading lookups and list are no longer needed
+    vector<PendingSegment>().swap(m_pending);
+    m_nodeIds.reset();
+    m_streetIds.reset();
+    m_compiled = true;
+}
+
+void StreetGraph::setLoadStatistics(const LoadStatistics& statistics)
+{
+    m_loadStatistics = statistics;
+}
+
+bool StreetGraph::addSnapshotSections(SnapshotWriter& writer) const
+{
+    // only a compiled graph has all of its arrays laid out
+    if (!m_compiled)
+        return false;
+
+    writer.addSection(SECTION_NODE_LATITUDES, m_latitudes.data(), m_latitudes.size() * sizeof(int));
+    writer.addSection(SECTION_NODE_LONGITUDES, m_longitudes.data(), m_longitudes.size() * sizeof(int));
+    writer.addSection(SECTION_COORD_TEXT, m_coordText.data(), m_coordText.size());
+    writer.addSection(SECTION_COORD_TEXT_OFFSETS, m_coordTextOffsets.data(), m_coordTextOffsets.size() * sizeof(int));
+    writer.addSection(SECTION_NODES_BY_KEY, m_nodesByKey.data(), m_nodesByKey.size() * sizeof(int));
+    writer.addSection(SECTION_EDGE_OFFSETS, m_offsets.data(), m_offsets.size() * sizeof(int));
+    writer.addSection(SECTION_EDGE_TARGETS, m_targets.data(), m_targets.size() * sizeof(int));
+    writer.addSection(SECTION_EDGE_LENGTHS, m_lengths.data(), m_lengths.size() * sizeof(float));
+    writer.addSection(SECTION_EDGE_STREETS, m_streets.data(), m_streets.size() * sizeof(int));
+    writer.addSection(SECTION_NAME_TEXT, m_nameText.data(), m_nameText.size());
+    writer.addSection(SECTION_NAME_OFFSETS, m_nameOffsets.data(), m_nameOffsets.size() * sizeof(int));
+    writer.addSection(SECTION_NODE_UNIT_VECTORS, m_unitVectors.data(), (long long)m_unitVectors.size() * sizeof(double));
+    return true;
+}
+
+bool StreetGraph::loadSnapshot(const string& fileName)
+{
+    // start from an empty graph and map the file
+    clear();
+    if (!m_snapshot.open(fileName))
+        return false;
+
+    // point every array straight at its section, checking that the sizes agree with each other
+    bool ok = m_snapshot.attach(SECTION_NODE_LATITUDES, m_latitudes);
+    int nNodes = m_latitudes.size();
+    ok = ok && m_snapshot.attach(SECTION_NODE_LONGITUDES, m_longitudes, nNodes)
+            && m_snapshot.attach(SECTION_COORD_TEXT, m_coordText)
+            && m_snapshot.attach(SECTION_COORD_TEXT_OFFSETS, m_coordTextOffsets, 2 * nNodes + 1)
+            && m_snapshot.attach(SECTION_NODES_BY_KEY, m_nodesByKey, nNodes)
+            && m_snapshot.attach(SECTION_EDGE_OFFSETS, m_offsets, nNodes + 1)
+            && m_snapshot.attach(SECTION_EDGE_TARGETS, m_targets);
+    int nEdges = m_targets.size();
+    ok = ok && m_offsets[nNodes] == nEdges
+            && m_coordTextOffsets[2 * nNodes] == m_coordText.size()
+            && m_snapshot.attach(SECTION_EDGE_LENGTHS, m_lengths, nEdges)
+            && m_snapshot.attach(SECTION_EDGE_STREETS, m_streets, nEdges)
+            && m_snapshot.attach(SECTION_NAME_TEXT, m_nameText)
+            && m_snapshot.attach(SECTION_NAME_OFFSETS, m_nameOffsets);
+    ok = ok && !m_nameOffsets.empty() && m_nameOffsets[m_nameOffsets.size() - 1] == m_nameText.size();
+
+    // the searches index with these ids without checking them, so a damaged file must be
+    // turned away here rather than read out of bounds later
+    ok = ok && isConsistent();
+    if (!ok) {
+        clear();
+        return false;
+    }
+    
+    // snapshots saved before the unit vectors were kept lack them, so work them out
+    if (!m_snapshot.attach(SECTION_NODE_UNIT_VECTORS, m_unitVectors, 3 * nNodes))
+        computeUnitVectors();
+
+    // record the size of what was mapped
+    m_loadStatistics.bytes = m_snapshot.fileSize();
+    m_loadStatistics.streets = getStreetCount();
+    m_loadStatistics.segments = nEdges / 2;
+    m_loadStatistics.nodes = nNodes;
+
+    m_compiled = true;
+    return true;
+}
+
+// check, once over every array, that the offsets only ever grow and that every node and
+// street id a mapped snapshot holds is in range
+bool StreetGraph::isConsistent() const
+{
+    int nNodes = m_latitudes.size();
+    int nStreets = getStreetCount();
+    if (!isAscending(m_offsets) || !isAscending(m_coordTextOffsets) || !isAscending(m_nameOffsets))
+        return false;
+    for (int i = 0; i < m_targets.size(); i++)
+        if (m_targets[i] < 0 || m_targets[i] >= nNodes || m_streets[i] < 0 || m_streets[i] >= nStreets)
+            return false;
+    for (int i = 0; i < nNodes; i++)
+        if (m_nodesByKey[i] < 0 || m_nodesByKey[i] >= nNodes)
+            return false;
+    return true;
+}
+
+// true if offsets start at 0 and never decrease
+bool StreetGraph::isAscending(const MappedArray<int>& offsets)
+{
+    if (offsets.empty() || offsets[0] != 0)
+        return false;
+    for (int i = 1; i < offsets.size(); i++)
+        if (offsets[i] < offsets[i - 1])
+            return false;
+    return true;
+}
+
+const MappedSnapshot& StreetGraph::getSnapshot() const
+{
+    return m_snapshot;
+}
+
+int StreetGraph::findNode(const GeoCoord& gc) const
+{
+    return findNode(makeCoordKey(gc));
+}
+
+int StreetGraph::findNode(const CoordKey& key) const
+{
+    // while loading, look the coordinate up among those added so far
+    if (!m_compiled) {
+        const int* found = m_nodeIds.find(key);
+        if (found == nullptr)
+            return -1;
+        return *found;
+    }
+
+    // once compiled, binary search the node ids sorted by coordinate
+    int low = 0;
+    int high = m_nodesByKey.size();
+    while (low < high) {
+        int middle = (low + high) / 2;
+        int node = m_nodesByKey[middle];
+        if (keyLess(m_latitudes[node], m_longitudes[node], key.latitude, key.longitude))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    // return the id of the given coordinate, or -1 if it is not on the map
+    if (low < m_nodesByKey.size()) {
+        int node = m_nodesByKey[low];
+        if (m_latitudes[node] == key.latitude && m_longitudes[node] == key.longitude)
+            return node;
+    }
+    return -1;
+}
+
+GeoCoord StreetGraph::getNodeCoord(int node) const
+{
+    // rebuild the coordinate from its original text, so it compares equal to the coordinate
+    // the map file (and any delivery using it) spelled out
+    return GeoCoord(getText(m_coordText, m_coordTextOffsets, 2 * node), getText(m_coordText, m_coordTextOffsets, 2 * node + 1));
+}
+
+double StreetGraph::distanceMiles(int from, int to) const
+{
+    // the same great-circle formula as distanceEarthMiles, worked from the stored coordinates
+    const double pi = 3.14159265358979323846;
+    double lat1r = m_latitudes[from] / COORD_KEY_UNITS_PER_DEGREE * pi / 180;
+    double lon1r = m_longitudes[from] / COORD_KEY_UNITS_PER_DEGREE * pi / 180;
+    double lat2r = m_latitudes[to] / COORD_KEY_UNITS_PER_DEGREE * pi / 180;
+    double lon2r = m_longitudes[to] / COORD_KEY_UNITS_PER_DEGREE * pi / 180;
+    double u = sin((lat2r - lat1r) / 2);
+    double v = sin((lon2r - lon1r) / 2);
+    double km = 2.0 * 6371.0 * asin(sqrt(u * u + cos(lat1r) * cos(lat2r) * v * v));
+    return km * (1 / 1.609344);
+}
+
+void StreetGraph::computeUnitVectors()
+{
+    // three values per node, filled in parallel since each takes a few trigonometric calls
+    int nNodes = getNodeCount();
+    vector<double> unitVectors(3 * (long long)nNodes);
+    ThreadPool& pool = ThreadPool::shared();
+    int nBlocks = min(nNodes, 8 * pool.size());
+    pool.parallelFor(nBlocks, [&](int b) {
+        int last = (long long)nNodes * (b + 1) / nBlocks;
+        for (int n = (long long)nNodes * b / nBlocks; n < last; n++)
+            toUnitVector(m_latitudes[n] / COORD_KEY_UNITS_PER_DEGREE, m_longitudes[n] / COORD_KEY_UNITS_PER_DEGREE, &unitVectors[3 * (long long)n]);
+    });
+    m_unitVectors.adopt(unitVectors);
+}
+
+int StreetGraph::getReverseEdge(int from, int edge) const
+{
+    // the other direction of a segment leaves the edge's target, leads back to from and
+    // has the same street and length
+    int to = m_targets[edge];
+    for (int e = m_offsets[to]; e < m_offsets[to + 1]; e++) {
+        if (m_targets[e] == from && m_streets[e] == m_streets[edge] && m_lengths[e] == m_lengths[edge])
+            return e;
+    }
+    return -1;
+}
+
+string StreetGraph::getStreetName(int street) const
+{
+    return getText(m_nameText, m_nameOffsets, street);
+}
+
+const LoadStatistics& StreetGraph::getLoadStatistics() const
+{
+    return m_loadStatistics;
+}
+
+StreetSegment StreetGraph::getSegment(int from, int edge) const
+{
+    return StreetSegment(getNodeCoord(from), getNodeCoord(m_targets[edge]), getStreetName(m_streets[edge]));
+}
+
+void StreetGraph::getSegments(const CompactRoute& route, list<StreetSegment>& segments) const
+{
+    int from = route.start;
+    for (int e : route.edges) {
+        segments.push_back(getSegment(from, e));
+        from = m_targets[e];
+    }
+}
+
+string StreetGraph::getText(const MappedArray<char>& text, const MappedArray<int>& offsets, int i) const
+{
+    return string(text.data() + offsets[i], offsets[i + 1] - offsets[i]);
+}
@@ -0,0 +1,283 @@
+// StreetGraph.h
+
+#ifndef STREETGRAPH_INCLUDED
+#define STREETGRAPH_INCLUDED
+
+#include <vector>
+#include <list>
+#include <string>
+#include <cmath>
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include "Snapshot.h"
+#include "GeoDistance.h"
+
+using namespace std;
+
+// Coordinate in whole units of 1e-7 degrees (about a centimeter), used as the key for
+// finding nodes so a lookup hashes and compares two integers instead of building and
+// comparing the coordinate's text.
+struct CoordKey
+{
+    CoordKey() : latitude(0), longitude(0) {}
+    CoordKey(int lat, int lon) : latitude(lat), longitude(lon) {}
+    int latitude;
+    int longitude;
+};
+
+const double COORD_KEY_UNITS_PER_DEGREE = 1e7;
+
+inline bool operator==(const CoordKey& lhs, const CoordKey& rhs)
+{
+    return lhs.latitude == rhs.latitude && lhs.longitude == rhs.longitude;
+}
+
+inline CoordKey makeCoordKey(const GeoCoord& gc)
+{
+    return CoordKey(lround(gc.latitude * COORD_KEY_UNITS_PER_DEGREE), lround(gc.longitude * COORD_KEY_UNITS_PER_DEGREE));
+}
+
+unsigned int hasher(const CoordKey& k);
+
+// Figures recorded by the last StreetMap::load; bytes / seconds is the load throughput.
+struct LoadStatistics
+{
+    LoadStatistics() : bytes(0), streets(0), segments(0), nodes(0), seconds(0) {}
+    long long bytes;
+    int streets;
+    int segments;
+    int nodes;
+    double seconds;
+};
+
+// View of the ids of the edges leaving one node, for use in a range-based for loop.
+// It only holds the bounds of the node's slice of the graph's edge arrays, so getting
+// one copies and allocates nothing.
+class EdgeRange
+{
+public:
+    class iterator
+    {
+    public:
+        iterator(int edge) : m_edge(edge) {}
+        int operator*() const { return m_edge; }
+        iterator& operator++() { m_edge++; return *this; }
+        bool operator!=(const iterator& other) const { return m_edge != other.m_edge; }
+        bool operator==(const iterator& other) const { return m_edge == other.m_edge; }
+    private:
+        int m_edge;
+    };
+
+    EdgeRange() : m_first(0), m_end(0) {}
+    EdgeRange(int first, int end) : m_first(first), m_end(end) {}
+    iterator begin() const { return iterator(m_first); }
+    iterator end() const { return iterator(m_end); }
+    int size() const { return m_end - m_first; }
+    bool empty() const { return m_first == m_end; }
+
+private:
+    int m_first;
+    int m_end;
+};
+
+// A route in the graph's own terms: the node it starts at and the ids of the edges along
+// it in order, with its length in miles. However long the route, it is one flat array of
+// ints; StreetSegments, with the strings of their coordinates and street name, are only
+// made from it where a route is handed out of the program (StreetGraph::getSegments).
+struct CompactRoute
+{
+    CompactRoute() : start(-1), distance(0) {}
+    int start;
+    vector<int> edges;
+    double distance;
+};
+
+// Compact, read-only form of the street map that the router and planner walk directly.
+//
+// Every coordinate is a node with a dense id (0 .. getNodeCount()-1) and every street
+// segment is stored twice, once leaving each of its ends, as an edge with a dense id.
+// The edges leaving node n are the ids firstEdge(n) .. endEdge(n)-1, laid out next to
+// each other in compressed sparse row form, and each edge only keeps the node it leads
+// to, its length in miles and the id of its street's name.
+//
+// Nodes are stored as fixed-point coordinates plus the original text of each coordinate,
+// and street names as one block of text, so every part of the graph is a flat array.
+// That lets a compiled graph be saved as a snapshot and later used straight from the
+// mapped file (see Snapshot.h) instead of being rebuilt from the text map.
+//
+// The graph is filled by StreetMap::load with addNode/addStreetName/addSegment and then
+// compile() lays out the edges; after that it is only ever handed out as const. A loader
+// that has already told its coordinates apart can add them with appendNode instead, which
+// skips the lookup table; such nodes can only be found once the graph is compiled.
+class StreetGraph
+{
+public:
+    StreetGraph();
+
+    // building (used while loading)
+    void clear();
+    void reserve(int nNodes, int nSegments, int nStreets);
+    int addNode(const GeoCoord& gc);
+    int addNode(const CoordKey& key, const char* latitudeText, int latitudeLength,
+                const char* longitudeText, int longitudeLength);
+    int appendNode(const CoordKey& key, const char* latitudeText, int latitudeLength,
+                   const char* longitudeText, int longitudeLength);
+    int addStreetName(const string& name);
+    void addSegment(int from, int to, int street);
+    void compile();
+    void setLoadStatistics(const LoadStatistics& statistics);
+
+    // snapshots; indices built over the graph add their own sections next to the graph's,
+    // and attach to the same mapped snapshot once it is loaded
+    bool addSnapshotSections(SnapshotWriter& writer) const;
+    bool loadSnapshot(const string& fileName);
+    const MappedSnapshot& getSnapshot() const;
+
+    // nodes
+    int getNodeCount() const;
+    int findNode(const GeoCoord& gc) const;
+    int findNode(const CoordKey& key) const;
+    CoordKey getNodeKey(int node) const;
+    GeoCoord getNodeCoord(int node) const;
+    double getLatitude(int node) const;     // in degrees, as GeoCoord has them
+    double getLongitude(int node) const;
+    double distanceMiles(int from, int to) const;
+    double estimateMiles(int from, int to) const;   // lower bound on distanceMiles, far cheaper
+
+    // edges
+    int getEdgeCount() const;
+    int firstEdge(int node) const;
+    int endEdge(int node) const;
+    EdgeRange getEdges(int node) const;
+    int getEdgeTarget(int edge) const;
+    float getEdgeLength(int edge) const;
+    int getEdgeStreet(int edge) const;
+    int getReverseEdge(int from, int edge) const;
+
+    // street names
+    int getStreetCount() const;
+    string getStreetName(int street) const;
+
+    const LoadStatistics& getLoadStatistics() const;
+
+    // turn the edge leaving node "from" back into the segment the rest of the program uses,
+    // or a whole route into its segments (added to the end of segments)
+    StreetSegment getSegment(int from, int edge) const;
+    void getSegments(const CompactRoute& route, list<StreetSegment>& segments) const;
+
+    StreetGraph(const StreetGraph&) = delete;
+    StreetGraph& operator=(const StreetGraph&) = delete;
+
+private:
+    struct PendingSegment {
+        int m_from;
+        int m_to;
+        int m_street;
+    };
+
+    // nodes: coordinates in CoordKey units, the original text of every coordinate (latitude
+    // then longitude, with 2 * nodes + 1 offsets into the text), and the node ids sorted by
+    // coordinate for looking nodes up once the graph is compiled
+    MappedArray<int> m_latitudes;
+    MappedArray<int> m_longitudes;
+    MappedArray<char> m_coordText;
+    MappedArray<int> m_coordTextOffsets;
+    MappedArray<int> m_nodesByKey;
+    MappedArray<double> m_unitVectors;  // x, y, z of every node on the unit sphere, for estimateMiles
+
+    // edges in compressed sparse row form: m_offsets has one more entry than there are nodes
+    MappedArray<int> m_offsets;
+    MappedArray<int> m_targets;
+    MappedArray<float> m_lengths;
+    MappedArray<int> m_streets;
+
+    // interned street names as one block of text, with one more offset than there are names
+    MappedArray<char> m_nameText;
+    MappedArray<int> m_nameOffsets;
+
+    // lookups used only while loading, and the segments added since the last compile()
+    ExpandableHashMap<CoordKey, int> m_nodeIds;
+    ExpandableHashMap<string, int> m_streetIds;
+    vector<PendingSegment> m_pending;
+    bool m_compiled;
+
+    MappedSnapshot m_snapshot;
+    LoadStatistics m_loadStatistics;
+
+    // Helper Functions
+    string getText(const MappedArray<char>& text, const MappedArray<int>& offsets, int i) const;
+    void computeUnitVectors();
+    bool isConsistent() const;
+    static bool isAscending(const MappedArray<int>& offsets);
+};
+
+// the accessors below are called for every edge the router looks at, so they are
+// defined here where the compiler can inline them
+
+inline int StreetGraph::getNodeCount() const
+{
+    return m_latitudes.size();
+}
+
+inline CoordKey StreetGraph::getNodeKey(int node) const
+{
+    return CoordKey(m_latitudes[node], m_longitudes[node]);
+}
+
+inline double StreetGraph::getLatitude(int node) const
+{
+    return m_latitudes[node] / COORD_KEY_UNITS_PER_DEGREE;
+}
+
+inline double StreetGraph::getLongitude(int node) const
+{
+    return m_longitudes[node] / COORD_KEY_UNITS_PER_DEGREE;
+}
+
+// called for every node A* reaches, as the estimate of the distance left to the end
+inline double StreetGraph::estimateMiles(int from, int to) const
+{
+    return chordMiles(m_unitVectors.data() + 3 * (long long)from, m_unitVectors.data() + 3 * (long long)to);
+}
+
+inline int StreetGraph::getEdgeCount() const
+{
+    return m_targets.size();
+}
+
+inline int StreetGraph::firstEdge(int node) const
+{
+    return m_offsets[node];
+}
+
+inline int StreetGraph::endEdge(int node) const
+{
+    return m_offsets[node + 1];
+}
+
+inline EdgeRange StreetGraph::getEdges(int node) const
+{
+    return EdgeRange(m_offsets[node], m_offsets[node + 1]);
+}
+
+inline int StreetGraph::getEdgeTarget(int edge) const
+{
+    return m_targets[edge];
+}
+
+inline float StreetGraph::getEdgeLength(int edge) const
+{
+    return m_lengths[edge];
+}
+
+inline int StreetGraph::getEdgeStreet(int edge) const
+{
+    return m_streets[edge];
+}
+
+inline int StreetGraph::getStreetCount() const
+{
+    return m_nameOffsets.size() - 1;
+}
+
+#endif
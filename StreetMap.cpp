@@ -4,16 +4,26 @@
 #include <functional>
 
 #include <fstream>
-#include <sstream>
 #include <string>
 #include <cstdlib>
+#include <cstring>
+#include <charconv>
+#include <chrono>
+#include <algorithm>
 #include "ExpandableHashMap.h"
+#include "StreetGraph.h"
+#include "ContractionHierarchy.h"
+#include "LandmarkTable.h"
+#include "ThreadPool.h"
+#include "PointGrid.h"
+#include "RouteCache.h"
 
 using namespace std;
 
 unsigned int hasher(const GeoCoord& g)
 {
-    return hash<string>()(g.latitudeText + g.longitudeText);
+    // hash the coordinate's numeric value so no temporary string is built per lookup
+    return hasher(makeCoordKey(g));
 }
 
 class StreetMapImpl
@@ -23,11 +33,26 @@ public:
     ~StreetMapImpl();
     bool load(string mapFile);
     bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    const StreetGraph* getGraph() const;
+    bool saveSnapshot(string snapshotFile) const;
+    bool buildContractionHierarchy();
+    const ContractionHierarchy* getHierarchy() const;
+    bool buildLandmarks(int nLandmarks);
+    const LandmarkTable* getLandmarks() const;
+    int findNearestNode(const GeoCoord& gc, double maxDistance) const;
+    RouteCache* getRouteCache() const;
     
     bool find(const GeoCoord& gc);
     
 private:
-    ExpandableHashMap<GeoCoord, vector<StreetSegment>> data;
+    StreetGraph m_graph;
+    ContractionHierarchy m_hierarchy;
+    LandmarkTable m_landmarks;
+    PointGrid m_nodeGrid;       // every node, for snapping places that are not exactly on the map
+    mutable RouteCache m_routeCache;    // routes found by every router on this map
+    
+    // Helper Function
+    void buildNodeGrid();
 };
 
 StreetMapImpl::StreetMapImpl()
@@ -41,109 +66,433 @@ StreetMapImpl::~StreetMapImpl()
 
 bool StreetMapImpl::find(const GeoCoord& gc) {
     
-    vector<StreetSegment>* found = data.find(gc);
+    return m_graph.findNode(gc) != -1;
+}
+
+const StreetGraph* StreetMapImpl::getGraph() const
+{
+    return &m_graph;
+}
+
+bool StreetMapImpl::saveSnapshot(string snapshotFile) const
+{
+    // write the loaded graph, and any index built over it, out so later loads can map
+    // them instead of parsing the text map and building the indices again
+    if (snapshotFile == "")
+        return false;
+    SnapshotWriter writer;
+    if (!m_graph.addSnapshotSections(writer))
+        return false;
+    if (m_hierarchy.isBuilt())
+        m_hierarchy.addSnapshotSections(writer);
+    if (m_landmarks.isBuilt())
+        m_landmarks.addSnapshotSections(writer);
+    return writer.write(snapshotFile);
+}
+
+bool StreetMapImpl::buildContractionHierarchy()
+{
+    // the hierarchy is built over a loaded map; it is kept until the next load
+    if (m_graph.getNodeCount() == 0)
+        return false;
+    m_hierarchy.build(m_graph);
+    return true;
+}
+
+const ContractionHierarchy* StreetMapImpl::getHierarchy() const
+{
+    // nullptr until a hierarchy has been built or loaded from a snapshot
+    if (!m_hierarchy.isBuilt())
+        return nullptr;
+    return &m_hierarchy;
+}
+
+bool StreetMapImpl::buildLandmarks(int nLandmarks)
+{
+    // the landmarks are picked on a loaded map; they are kept until the next load
+    if (m_graph.getNodeCount() == 0 || nLandmarks <= 0)
+        return false;
+    m_landmarks.build(m_graph, nLandmarks);
+    return true;
+}
+
+const LandmarkTable* StreetMapImpl::getLandmarks() const
+{
+    // nullptr until landmarks have been built or loaded from a snapshot
+    if (!m_landmarks.isBuilt())
+        return nullptr;
+    return &m_landmarks;
+}
+
+int StreetMapImpl::findNearestNode(const GeoCoord& gc, double maxDistance) const
+{
+    // a place exactly on the map needs no search
+    int node = m_graph.findNode(gc);
+    if (node != -1)
+        return node;
     
-    if (found == nullptr)
+    // otherwise take the closest node, if it is close enough
+    node = m_nodeGrid.findNearest(gc.latitude, gc.longitude);
+    if (node == -1 || distanceEarthMiles(gc, m_graph.getNodeCoord(node)) > maxDistance)
+        return -1;
+    return node;
+}
+
+RouteCache* StreetMapImpl::getRouteCache() const
+{
+    return &m_routeCache;
+}
+
+void StreetMapImpl::buildNodeGrid()
+{
+    int nNodes = m_graph.getNodeCount();
+    vector<double> latitudes(nNodes);
+    vector<double> longitudes(nNodes);
+    for (int n = 0; n < nNodes; n++) {
+        CoordKey key = m_graph.getNodeKey(n);
+        latitudes[n] = key.latitude / COORD_KEY_UNITS_PER_DEGREE;
+        longitudes[n] = key.longitude / COORD_KEY_UNITS_PER_DEGREE;
+    }
+    m_nodeGrid.build(latitudes, longitudes);
+}
+
+// return the end of the line starting at p (its '\n', or end if it is the last line)
+static const char* endOfLine(const char* p, const char* end)
+{
+    const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+    return newline == nullptr ? end : newline;
+}
+
+// return the start of the line after the one starting at p
+static const char* nextLine(const char* p, const char* end)
+{
+    const char* eol = endOfLine(p, end);
+    return eol == end ? end : eol + 1;
+}
+
+// read the segment count on the line from p to eol
+static bool parseCount(const char* p, const char* eol, int& count)
+{
+    while (p < eol && (*p == ' ' || *p == '\t'))
+        p++;
+    from_chars_result result = from_chars(p, eol, count);
+    return result.ec == errc() && count >= 0;
+}
+
+// read the next whitespace separated coordinate value on the line, remembering where its
+// text is and converting it straight to whole units of 1e-7 degrees (the same units as
+// CoordKey) without going through a string or a double; p is left just past the value
+static bool parseCoordinate(const char*& p, const char* eol, const char*& text, int& length, int& fixedPoint)
+{
+    // skip the separating whitespace
+    while (p < eol && (*p == ' ' || *p == '\t'))
+        p++;
+    text = p;
+
+    // sign
+    bool negative = false;
+    if (p < eol && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    // whole degrees
+    long long value = 0;
+    int nDigits = 0;
+    while (p < eol && *p >= '0' && *p <= '9' && value < 1000) {
+        value = value * 10 + (*p - '0');
+        p++;
+        nDigits++;
+    }
+
+    // fraction, keeping seven digits and rounding on the eighth
+    int nFractionDigits = 0;
+    bool roundUp = false;
+    if (p < eol && *p == '.') {
+        p++;
+        while (p < eol && *p >= '0' && *p <= '9') {
+            if (nFractionDigits < 7) {
+                value = value * 10 + (*p - '0');
+                nFractionDigits++;
+            }
+            else if (nFractionDigits == 7) {
+                roundUp = *p >= '5';
+                nFractionDigits++;
+            }
+            p++;
+            nDigits++;
+        }
+    }
+    for (; nFractionDigits < 7; nFractionDigits++)
+        value *= 10;
+    if (roundUp)
+        value++;
+
+    // the value must be a number and must end at whitespace or the end of the line
+    length = p - text;
+    if (nDigits == 0 || (p < eol && *p != ' ' && *p != '\t' && *p != '\r'))
         return false;
+    fixedPoint = negative ? -value : value;
     return true;
 }
 
+// one street of the map file, as found by the first pass
+struct StreetRecord
+{
+    const char* m_name;
+    int m_nameLength;
+    const char* m_segments;     // start of its first segment line
+    int m_count;
+    int m_firstSegment;         // index of its first segment among all the file's segments
+};
+
+// walk the records of the map file without parsing coordinates, noting where each street
+// and its segments are so the segments can be parsed in parallel
+static bool findRecords(const char* p, const char* end, vector<StreetRecord>& records, int& nSegments)
+{
+    records.clear();
+    nSegments = 0;
+    while (p < end) {
+        // skip blank lines between streets
+        const char* eol = endOfLine(p, end);
+        const char* nameEnd = eol;
+        if (nameEnd > p && nameEnd[-1] == '\r')
+            nameEnd--;
+        if (nameEnd == p) {
+            p = nextLine(p, end);
+            continue;
+        }
+
+        // street name, then segment count
+        StreetRecord r;
+        r.m_name = p;
+        r.m_nameLength = nameEnd - p;
+        p = nextLine(p, end);
+        if (p >= end || !parseCount(p, endOfLine(p, end), r.m_count))
+            return false;
+        p = nextLine(p, end);
+        r.m_segments = p;
+        r.m_firstSegment = nSegments;
+
+        // jump over the segment lines
+        for (int i = 0; i < r.m_count; i++) {
+            if (p >= end)
+                return false;
+            p = nextLine(p, end);
+        }
+        records.push_back(r);
+        nSegments += r.m_count;
+    }
+    return true;
+}
+
+// read the two coordinates of the segment line from p to eol into keys, and optionally the
+// spans of their text (latitude and longitude of the first end, then of the second)
+static bool parseSegmentLine(const char* p, const char* eol, CoordKey keys[2],
+                             const char* text[4] = nullptr, int length[4] = nullptr)
+{
+    for (int i = 0; i < 4; i++) {
+        const char* valueText;
+        int valueLength;
+        int value;
+        if (!parseCoordinate(p, eol, valueText, valueLength, value))
+            return false;
+        if (i % 2 == 0)
+            keys[i / 2].latitude = value;
+        else
+            keys[i / 2].longitude = value;
+        if (text != nullptr) {
+            text[i] = valueText;
+            length[i] = valueLength;
+        }
+    }
+    return true;
+}
+
+// the most shards the coordinates are split into while giving them node ids
+const int MAX_LOAD_SHARDS = 64;
+
 bool StreetMapImpl::load(string mapFile)
 {
     // if file is empty, return false
     if (mapFile == "")
         return false;
     
-    // convert file to useable format
-    ifstream file(mapFile);
-    std::string line;
-
-    // iterate through the entire file, each street and its segments
-    int count = 0;
-    while (std::getline(file, line))
-    {
-        // record street name
-        string streetName = line;
-        
-        // record number of segments for this street
-        getline(file, line);
-        int nSegments = stoi(line);
-        
-        // loop through the street's segments
-        for (int i = 0; i < nSegments; i++) {
-            
-            // use vector to save the coordinate values of the segment
-            vector<string> coordValues;
-            
-            // get next segment's line
-            getline(file, line);
-            
-            // loop through four values of the segment's coordinates
-            int charCount = 0;
-            string number;
-            for (int j = 0; j < 4; j++) {
-                // record each value needed for the coordinates
-                while (line[charCount] != ' ' && charCount < line.size()) {
-                    number += line[charCount];
-                    charCount++;
+    chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+    
+    // the previous map and the indices built over it are dropped together, so a load that
+    // fails leaves an empty map rather than a graph whose indices are gone
+    m_graph.clear();
+    m_hierarchy.clear();
+    m_landmarks.clear();
+    m_nodeGrid.clear();
+    m_routeCache.clear();
+    
+    // a preprocessed snapshot is mapped and used as is, along with any indices saved in it
+    if (isSnapshotFile(mapFile)) {
+        if (!m_graph.loadSnapshot(mapFile))
+            return false;
+        m_hierarchy.attach(m_graph.getSnapshot(), m_graph);
+        m_landmarks.attach(m_graph.getSnapshot(), m_graph.getNodeCount());
+        buildNodeGrid();
+        LoadStatistics statistics = m_graph.getLoadStatistics();
+        statistics.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        m_graph.setLoadStatistics(statistics);
+        return true;
+    }
+    
+    // read the whole file into memory in one block
+    ifstream file(mapFile, ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, ios::end);
+    long long fileSize = file.tellg();
+    file.seekg(0, ios::beg);
+    vector<char> buffer(fileSize);
+    if (fileSize > 0 && !file.read(buffer.data(), fileSize))
+        return false;
+    const char* begin = buffer.data();
+    const char* end = begin + fileSize;
+    
+    // first pass: find where every street and its segments are, which only looks for line ends
+    vector<StreetRecord> records;
+    int nSegments;
+    if (!findRecords(begin, end, records, nSegments))
+        return false;
+    int nStreets = records.size();
+    
+    // split the streets into chunks of about the same number of segments, a few per thread
+    // so threads that finish early can pick up more work
+    ThreadPool& pool = ThreadPool::shared();
+    int nShards = min(pool.size(), MAX_LOAD_SHARDS);
+    int segmentsPerChunk = max(1, nSegments / (4 * pool.size()));
+    vector<int> chunkStarts;
+    for (int r = 0; r < nStreets; r++) {
+        if (chunkStarts.empty() || records[r].m_firstSegment - records[chunkStarts.back()].m_firstSegment >= segmentsPerChunk)
+            chunkStarts.push_back(r);
+    }
+    int nChunks = chunkStarts.size();
+    chunkStarts.push_back(nStreets);
+    
+    // second pass, one chunk per task: parse each segment's coordinates straight into the
+    // keys of its two ends (ends 2i and 2i + 1 belong to segment i), and deal the ends out
+    // to shards by hash so each shard's coordinates can be told apart without locking
+    vector<CoordKey> ends(2 * nSegments);
+    vector<const char*> lines(nSegments);
+    vector<vector<vector<int>>> shardEnds(nChunks, vector<vector<int>>(nShards));
+    vector<char> chunkParsed(nChunks, true);
+    pool.parallelFor(nChunks, [&](int c) {
+        for (int r = chunkStarts[c]; r < chunkStarts[c + 1]; r++) {
+            const char* p = records[r].m_segments;
+            for (int i = 0; i < records[r].m_count; i++) {
+                int segment = records[r].m_firstSegment + i;
+                if (!parseSegmentLine(p, endOfLine(p, end), &ends[2 * segment])) {
+                    chunkParsed[c] = false;
+                    return;
                 }
-                coordValues.push_back(number);
-                charCount++;
-                number = "";
-            }
-            
-            // create geocoordinates for the ends of the street segment
-            GeoCoord start(coordValues[0], coordValues[1]);
-            GeoCoord end(coordValues[2], coordValues[3]);
-
-            // create forward and reverse format of the street segment
-            StreetSegment forward(start, end, streetName);
-            StreetSegment reverse(end, start, streetName);
-            
-            // add the forward segment to the data map
-            vector<StreetSegment>* findStart = data.find(start);
-            if (findStart != nullptr) {
-                findStart->push_back(forward);
-            }
-            else {
-                vector<StreetSegment> startValues;
-                startValues.push_back(forward);
-                data.associate(start, startValues);
+                lines[segment] = p;
+                for (int e = 2 * segment; e < 2 * segment + 2; e++)
+                    shardEnds[c][(unsigned long long)hasher(ends[e]) * nShards >> 32].push_back(e);
+                p = nextLine(p, end);
             }
-            
-            // add the reverse segment to the data map
-            vector<StreetSegment>* findEnd = data.find(end);
-            if (findEnd != nullptr) {
-                findEnd->push_back(reverse);
-            }
-            else {
-                vector<StreetSegment> endValues;
-                endValues.push_back(reverse);
-                data.associate(end, endValues);
+        }
+    });
+    if (count(chunkParsed.begin(), chunkParsed.end(), false) != 0)
+        return false;
+    
+    // number the distinct coordinates of each shard, one shard per task; going through the
+    // chunks in order means each shard sees its ends in file order, so the first end of every
+    // coordinate is the one that gets marked
+    vector<int> nodeOfEnd(ends.size());
+    vector<unsigned char> firstInShard(ends.size(), 0);     // 1 + shard at a coordinate's first end
+    pool.parallelFor(nShards, [&](int s) {
+        ExpandableHashMap<CoordKey, int> seen;
+        seen.reserve((nSegments + nStreets) / nShards + 1);
+        int nSeen = 0;
+        for (int c = 0; c < nChunks; c++) {
+            for (int e : shardEnds[c][s]) {
+                int* found = seen.find(ends[e]);
+                if (found != nullptr)
+                    nodeOfEnd[e] = *found;
+                else {
+                    seen.associate(ends[e], nSeen);
+                    nodeOfEnd[e] = nSeen++;
+                    firstInShard[e] = s + 1;
+                }
             }
         }
+    });
+    
+    // give the coordinates their node ids in the order they first appear in the file, so the
+    // ids do not depend on the number of threads and match a one-at-a-time load
+    vector<vector<int>> shardNodeIds(nShards);
+    vector<int> firstEndOfNode;
+    for (int e = 0; e < ends.size(); e++) {
+        if (firstInShard[e] != 0) {
+            shardNodeIds[firstInShard[e] - 1].push_back(firstEndOfNode.size());
+            firstEndOfNode.push_back(e);
+        }
+    }
+    pool.parallelFor(nShards, [&](int s) {
+        for (int c = 0; c < nChunks; c++) {
+            for (int e : shardEnds[c][s])
+                nodeOfEnd[e] = shardNodeIds[s][nodeOfEnd[e]];
+        }
+    });
+    
+    // add the nodes to the empty graph, keeping the text each coordinate had where it first
+    // appeared
+    m_graph.reserve(firstEndOfNode.size(), nSegments, nStreets);
+    for (int n = 0; n < firstEndOfNode.size(); n++) {
+        int e = firstEndOfNode[n];
+        CoordKey keys[2];
+        const char* text[4];
+        int length[4];
+        parseSegmentLine(lines[e / 2], endOfLine(lines[e / 2], end), keys, text, length);
+        int j = e % 2;
+        m_graph.appendNode(keys[j], text[2 * j], length[2 * j], text[2 * j + 1], length[2 * j + 1]);
+    }
+    
+    // then every street's name and segments; the graph stores each segment in both directions
+    for (int r = 0; r < nStreets; r++) {
+        int streetId = m_graph.addStreetName(string(records[r].m_name, records[r].m_nameLength));
+        for (int i = 0; i < records[r].m_count; i++) {
+            int segment = records[r].m_firstSegment + i;
+            m_graph.addSegment(nodeOfEnd[2 * segment], nodeOfEnd[2 * segment + 1], streetId);
+        }
     }
+    
+    // lay the segments out for fast traversal
+    m_graph.compile();
+    buildNodeGrid();
+    
+    // record how long this took for anyone measuring load throughput
+    LoadStatistics statistics;
+    statistics.bytes = fileSize;
+    statistics.streets = nStreets;
+    statistics.segments = nSegments;
+    statistics.nodes = m_graph.getNodeCount();
+    statistics.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    m_graph.setLoadStatistics(statistics);
 
     return true;
 }
 
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-    // search through data map for segments linked to given gc
-    const vector<StreetSegment>* gcValues = data.find(gc);
+    // search through the graph for the given gc
+    int node = m_graph.findNode(gc);
     
     // if no segments were found, return false
-    if (gcValues == nullptr)
+    if (node == -1)
         return false;
     
     // clear segs of any previous data
     segs.clear();
     
     // add found segments to segs
-    for (int i = 0; i < gcValues->size(); i++) {
-        StreetSegment* s = new StreetSegment((*gcValues)[i].start, (*gcValues)[i].end, (*gcValues)[i].name);
-        segs.push_back(*s);
-    }
+    for (int e : m_graph.getEdges(node))
+        segs.push_back(m_graph.getSegment(node, e));
     
     return true;
 }
@@ -176,3 +525,43 @@ bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegmen
 bool StreetMap::find(const GeoCoord& g) {
     return m_impl->find(g);
 }
+
+const StreetGraph* StreetMap::getGraph() const
+{
+    return m_impl->getGraph();
+}
+
+bool StreetMap::saveSnapshot(string snapshotFile) const
+{
+    return m_impl->saveSnapshot(snapshotFile);
+}
+
+bool StreetMap::buildContractionHierarchy()
+{
+    return m_impl->buildContractionHierarchy();
+}
+
+const ContractionHierarchy* StreetMap::getHierarchy() const
+{
+    return m_impl->getHierarchy();
+}
+
+bool StreetMap::buildLandmarks(int nLandmarks)
+{
+    return m_impl->buildLandmarks(nLandmarks);
+}
+
+const LandmarkTable* StreetMap::getLandmarks() const
+{
+    return m_impl->getLandmarks();
+}
+
+int StreetMap::findNearestNode(const GeoCoord& gc, double maxDistance) const
+{
+    return m_impl->findNearestNode(gc, maxDistance);
+}
+
+RouteCache* StreetMap::getRouteCache() const
+{
+    return m_impl->getRouteCache();
+}
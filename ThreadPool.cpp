@@ -0,0 +1,105 @@
+#include "ThreadPool.h"
+
+using namespace std;
+
+// set on pool threads, and on a caller while it takes part in a loop
+static thread_local bool t_insideLoop = false;
+
+ThreadPool::ThreadPool(int nThreads)
+:   m_body(nullptr), m_next(0), m_count(0), m_active(0), m_loop(0), m_stopping(false)
+{
+    if (nThreads <= 0)
+        nThreads = thread::hardware_concurrency();
+    if (nThreads <= 0)
+        nThreads = 1;
+
+    // the caller of parallelFor does its share of the work, so one thread fewer is started
+    for (int i = 1; i < nThreads; i++)
+        m_workers.push_back(thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    // wake every worker so it sees it should stop, then wait for them
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (int i = 0; i < m_workers.size(); i++)
+        m_workers[i].join();
+}
+
+int ThreadPool::size() const
+{
+    return m_workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int)>& body)
+{
+    // run small loops, nested loops and loops on a pool without workers right here
+    if (count <= 0)
+        return;
+    if (count == 1 || m_workers.empty() || t_insideLoop) {
+        for (int i = 0; i < count; i++)
+            body(i);
+        return;
+    }
+
+    // one loop at a time; start it and wake the workers
+    lock_guard<mutex> loopLock(m_loopMutex);
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_body = &body;
+        m_next = 0;
+        m_count = count;
+        m_active = m_workers.size();
+        m_loop++;
+    }
+    m_wake.notify_all();
+
+    // do our share, then wait for the workers to finish theirs
+    t_insideLoop = true;
+    runIterations();
+    t_insideLoop = false;
+
+    unique_lock<mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_active == 0; });
+    m_body = nullptr;
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::workerLoop()
+{
+    t_insideLoop = true;
+    unsigned long long seen = 0;
+    while (true) {
+        // sleep until a new loop starts or the pool is destroyed
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_wake.wait(lock, [this, seen] { return m_stopping || m_loop != seen; });
+            if (m_stopping)
+                return;
+            seen = m_loop;
+        }
+
+        runIterations();
+
+        // the last worker to finish lets the caller return
+        lock_guard<mutex> lock(m_mutex);
+        if (--m_active == 0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::runIterations()
+{
+    // take iterations until there are none left
+    for (int i = m_next++; i < m_count; i = m_next++)
+        (*m_body)(i);
+}
@@ -0,0 +1,54 @@
+// ThreadPool.h
+
+#ifndef THREADPOOL_INCLUDED
+#define THREADPOOL_INCLUDED
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+using namespace std;
+
+// Fixed set of worker threads that share the iterations of a loop with the calling thread.
+//
+// parallelFor(count, body) runs body(0) .. body(count - 1) and returns once all of them are
+// done. Iterations are handed out one at a time, so they may run in any order and on any
+// thread; bodies must only write to state that belongs to their own iteration. A
+// parallelFor started from inside a body runs sequentially on that thread, so code that
+// parallelizes itself can be called from code that is already running in parallel.
+class ThreadPool
+{
+public:
+    ThreadPool(int nThreads = 0);   // 0 means one thread per hardware thread
+    ~ThreadPool();
+    int size() const;               // threads working on a loop, counting the caller
+    void parallelFor(int count, const function<void(int)>& body);
+
+    // pool shared by everything in the program that wants to run in parallel
+    static ThreadPool& shared();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+private:
+    vector<thread> m_workers;
+    mutex m_loopMutex;              // held by the caller for the whole of a loop
+    mutex m_mutex;                  // guards the fields below
+    condition_variable m_wake;
+    condition_variable m_done;
+    const function<void(int)>* m_body;
+    atomic<int> m_next;
+    int m_count;
+    int m_active;                   // workers that have not finished the current loop
+    unsigned long long m_loop;      // number of loops started, so workers can spot a new one
+    bool m_stopping;
+
+    // Helper Functions
+    void workerLoop();
+    void runIterations();
+};
+
+#endif
@@ -0,0 +1,368 @@
+// provided.h
+
+#ifndef PROVIDED_INCLUDED
+#define PROVIDED_INCLUDED
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <cmath>
+
+struct GeoCoord
+{
+    GeoCoord(std::string lat, std::string lon)
+     : latitudeText(lat), longitudeText(lon), latitude(stod(lat)), longitude(stod(lon))
+    {}
+
+    GeoCoord()
+     : latitudeText("0"), longitudeText("0"), latitude(0), longitude(0)
+    {}
+
+    std::string latitudeText;
+    std::string longitudeText;
+    double latitude;
+    double longitude;
+};
+
+inline
+bool operator==(const GeoCoord& lhs, const GeoCoord& rhs)
+{
+    return lhs.latitudeText == rhs.latitudeText  &&  lhs.longitudeText == rhs.longitudeText;
+}
+
+inline
+bool operator!=(const GeoCoord& lhs, const GeoCoord& rhs)
+{
+    return !(lhs == rhs);
+}
+
+inline
+bool operator<(const GeoCoord& lhs, const GeoCoord& rhs)
+{
+    if (lhs.latitudeText < rhs.latitudeText)
+        return true;
+    if (lhs.latitudeText > rhs.latitudeText)
+        return false;
+    return lhs.longitudeText < rhs.longitudeText;
+}
+
+inline
+std::ostream& operator<<(std::ostream& o, const GeoCoord& g)
+{
+    return o << g.latitudeText << "," << g.longitudeText;
+}
+
+struct StreetSegment
+{
+    StreetSegment(const GeoCoord& s, const GeoCoord& e, std::string streetName)
+     : start(s), end(e), name(streetName)
+    {}
+
+    StreetSegment()
+    {}
+
+    GeoCoord start;
+    GeoCoord end;
+    std::string name;
+};
+
+struct DeliveryRequest
+{
+    DeliveryRequest(std::string it, const GeoCoord& loc)
+     : item(it), location(loc)
+    {}
+
+    std::string item;
+    GeoCoord location;
+};
+
+class DeliveryCommand
+{
+public:
+    void initAsProceedCommand(std::string dir, std::string streetName, double dist)
+    {
+        m_type = PROCEED;
+        m_direction = dir;
+        m_streetName = streetName;
+        m_distance = dist;
+    }
+
+    void initAsTurnCommand(std::string dir, std::string streetName)
+    {
+        m_type = TURN;
+        m_direction = dir;
+        m_streetName = streetName;
+        m_distance = 0;
+    }
+
+    void initAsDeliverCommand(std::string item)
+    {
+        m_type = DELIVER;
+        m_item = item;
+        m_distance = 0;
+    }
+
+    std::string description() const
+    {
+        switch (m_type)
+        {
+          case PROCEED:
+            return "Proceed " + std::to_string(m_distance) + " miles " + m_direction + " on " + m_streetName;
+          case TURN:
+            return "Turn " + m_direction + " on " + m_streetName;
+          case DELIVER:
+            return "Deliver " + m_item;
+          default:
+            return "<invalid>";
+        }
+    }
+
+private:
+    enum CommandType { INVALID, PROCEED, TURN, DELIVER };
+
+    CommandType m_type = INVALID;
+    std::string m_direction;
+    std::string m_streetName;
+    std::string m_item;
+    double m_distance = 0;
+};
+
+enum DeliveryResult
+{
+    DELIVERY_SUCCESS, NO_ROUTE, BAD_COORD
+};
+
+// compiled forms of the map and the indices built over it, declared where they are defined
+class StreetGraph;
+enum RouteSearchMode : int;
+class ContractionHierarchy;
+class LandmarkTable;
+class RouteCache;
+class ShortestPathTree;
+struct CompactRoute;
+
+class StreetMapImpl;
+
+class StreetMap
+{
+public:
+    StreetMap();
+    ~StreetMap();
+    bool load(std::string mapFile);
+    bool getSegmentsThatStartWith(const GeoCoord& gc, std::vector<StreetSegment>& segs) const;
+    bool find(const GeoCoord& g);
+
+    // the compiled map the router and planner walk directly
+    const StreetGraph* getGraph() const;
+    // write what load() built to a file load() can map back in place of the text map
+    bool saveSnapshot(std::string snapshotFile) const;
+    // preprocess the loaded map so routes can be searched far faster; nullptr until built
+    bool buildContractionHierarchy();
+    const ContractionHierarchy* getHierarchy() const;
+    // pick landmarks whose distances bound the rest of a route; nullptr until built
+    bool buildLandmarks(int nLandmarks);
+    const LandmarkTable* getLandmarks() const;
+    // the node at gc, or else the closest one no more than maxDistance miles away; -1 if none
+    int findNearestNode(const GeoCoord& gc, double maxDistance) const;
+    // routes already found on this map, shared by the routers that use it
+    RouteCache* getRouteCache() const;
+
+private:
+    StreetMapImpl* m_impl;
+      // StreetMap can not be copied or assigned.  We offer no implementation.
+    StreetMap(const StreetMap&) = delete;
+    StreetMap& operator=(const StreetMap&) = delete;
+};
+
+class PointToPointRouterImpl;
+
+class PointToPointRouter
+{
+public:
+    PointToPointRouter(const StreetMap* sm);
+    ~PointToPointRouter();
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        std::list<StreetSegment>& route,
+        double& totalDistanceTravelled) const;
+
+    // the same, choosing how the shortest route is searched for
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        std::list<StreetSegment>& route,
+        double& totalDistanceTravelled,
+        RouteSearchMode mode) const;
+
+    // the same routes as edge ids of the map's StreetGraph, left for the caller to expand
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        CompactRoute& route) const;
+
+    // road distances between every pair of locations, row by row: distances[i * n + j] is
+    // from locations[i] to locations[j], infinite if there is no route
+    DeliveryResult computeDistanceMatrix(
+        const std::vector<GeoCoord>& locations,
+        std::vector<double>& distances) const;
+
+    // move places off the map to the closest node within this many miles (0, the default,
+    // allows only places on the map)
+    void setSnapDistance(double miles);
+    // look routes up in the map's route cache, and add the ones found to it (off by default);
+    // only the default search is cached, so routes asked for with a RouteSearchMode are
+    // always searched for
+    void setRouteCaching(bool enabled);
+
+    // search once from source until every target is reached; the route from the source to
+    // targets[i], or from targets[i] back to it, is then read off the tree
+    DeliveryResult buildShortestPathTree(
+        const GeoCoord& source,
+        const std::vector<GeoCoord>& targets,
+        ShortestPathTree& tree) const;
+    DeliveryResult generateRouteFromSource(
+        const ShortestPathTree& tree,
+        int target,
+        std::list<StreetSegment>& route,
+        double& totalDistanceTravelled) const;
+    DeliveryResult generateRouteToSource(
+        const ShortestPathTree& tree,
+        int target,
+        std::list<StreetSegment>& route,
+        double& totalDistanceTravelled) const;
+    DeliveryResult generateRouteFromSource(
+        const ShortestPathTree& tree,
+        int target,
+        CompactRoute& route) const;
+    DeliveryResult generateRouteToSource(
+        const ShortestPathTree& tree,
+        int target,
+        CompactRoute& route) const;
+
+private:
+    PointToPointRouterImpl* m_impl;
+      // PointToPointRouter can not be copied or assigned.  We offer no implementation.
+    PointToPointRouter(const PointToPointRouter&) = delete;
+    PointToPointRouter& operator=(const PointToPointRouter&) = delete;
+};
+
+class DeliveryOptimizerImpl;
+
+class DeliveryOptimizer
+{
+public:
+    DeliveryOptimizer(const StreetMap* sm);
+    ~DeliveryOptimizer();
+    void optimizeDeliveryOrder(
+        const GeoCoord& depot,
+        std::vector<DeliveryRequest>& deliveries,
+        double& oldCrowDistance,
+        double& newCrowDistance) const;
+
+    // seconds the local search may spend improving an order (by default it runs until no
+    // move helps)
+    void setTimeBudget(double seconds);
+
+    // split the deliveries among nVehicles vehicles, each carrying at most capacity (loads
+    // gives each delivery's load; if empty, each counts 1), in the order each should make
+    // them; false if they do not fit
+    bool optimizeFleetDeliveries(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        const std::vector<double>& loads,
+        int nVehicles,
+        double capacity,
+        std::vector<std::vector<DeliveryRequest>>& vehicleDeliveries) const;
+
+private:
+    DeliveryOptimizerImpl* m_impl;
+      // DeliveryOptimizer can not be copied or assigned.  We offer no implementation.
+    DeliveryOptimizer(const DeliveryOptimizer&) = delete;
+    DeliveryOptimizer& operator=(const DeliveryOptimizer&) = delete;
+};
+
+class DeliveryPlannerImpl;
+
+class DeliveryPlanner
+{
+public:
+    DeliveryPlanner(const StreetMap* sm);
+    ~DeliveryPlanner();
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        std::vector<DeliveryCommand>& commands,
+        double& totalDistanceTravelled) const;
+
+    // passed on to the routers the planner uses
+    void setSnapDistance(double miles);
+    void setRouteCaching(bool enabled);
+
+    // split the deliveries as DeliveryOptimizer::optimizeFleetDeliveries does and plan a
+    // route from the depot and back for each vehicle
+    DeliveryResult generateFleetDeliveryPlans(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        const std::vector<double>& loads,
+        int nVehicles,
+        double capacity,
+        std::vector<std::vector<DeliveryCommand>>& vehicleCommands,
+        std::vector<double>& vehicleDistances) const;
+
+private:
+    DeliveryPlannerImpl* m_impl;
+      // DeliveryPlanner can not be copied or assigned.  We offer no implementation.
+    DeliveryPlanner(const DeliveryPlanner&) = delete;
+    DeliveryPlanner& operator=(const DeliveryPlanner&) = delete;
+};
+
+  // Return the distance in kilometers between the two points
+inline
+double distanceEarthKM(const GeoCoord& g1, const GeoCoord& g2)
+{
+    const double earthRadiusKm = 6371.0;
+    const double pi = 4 * std::atan(1.0);
+    auto deg2rad = [pi](double deg) { return deg * pi / 180; };
+    double lat1r = deg2rad(g1.latitude);
+    double lon1r = deg2rad(g1.longitude);
+    double lat2r = deg2rad(g2.latitude);
+    double lon2r = deg2rad(g2.longitude);
+    double u = std::sin((lat2r - lat1r) / 2);
+    double v = std::sin((lon2r - lon1r) / 2);
+    return 2.0 * earthRadiusKm * std::asin(std::sqrt(u * u + std::cos(lat1r) * std::cos(lat2r) * v * v));
+}
+
+  // Return the distance in miles between the two points
+inline
+double distanceEarthMiles(const GeoCoord& g1, const GeoCoord& g2)
+{
+    const double milesPerKm = 1 / 1.609344;
+    return distanceEarthKM(g1, g2) * milesPerKm;
+}
+
+  // Return the angle of the line segment, in degrees, from 0 up to but not including 360
+inline
+double angleOfLine(const StreetSegment& seg)
+{
+    const double pi = 4 * std::atan(1.0);
+    double angle = std::atan2(seg.end.latitude - seg.start.latitude, seg.end.longitude - seg.start.longitude) * 180 / pi;
+    if (angle < 0)
+        angle += 360;
+    return angle;
+}
+
+  // Return the angle between the two line segments, in degrees, from 0 up to but not including 360
+inline
+double angleBetween2Lines(const StreetSegment& line1, const StreetSegment& line2)
+{
+    double angle1 = angleOfLine(line1);
+    double angle2 = angleOfLine(line2);
+    double result = angle2 - angle1;
+    if (result < 0)
+        result += 360;
+    return result;
+}
+
+#endif // PROVIDED_INCLUDED